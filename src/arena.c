@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+#include "defines.h"
+#include "globals.h"
+#include "utils.h"
+#include "arena.h"
+
+// Allocation sizes are rounded up to this, none needed on the eZ80
+#ifdef AGONDEV
+#define ARENA_ALIGNMENT 1
+#else
+#define ARENA_ALIGNMENT sizeof(void *)
+#endif
+
+// Block header, the allocated space follows directly after it
+typedef struct arenablock {
+    struct arenablock *next;
+} arenablock_t;
+
+void initArena(arena_t *arena, uint24_t *bytecounter) {
+    freeArena(arena);
+    arena->bytecounter = bytecounter;
+    *bytecounter = 0;
+}
+
+// Allocate a new block and link it in, counting the complete block size
+void *_arenaBlock(arena_t *arena, size_t size) {
+    arenablock_t *block;
+
+    block = (arenablock_t *)malloc(sizeof(arenablock_t) + size);
+    if(block == NULL) {
+        error(message[ERROR_MEMORY],0);
+        return NULL;
+    }
+    block->next = (arenablock_t *)arena->blocks;
+    arena->blocks = block;
+    *arena->bytecounter += sizeof(arenablock_t) + size;
+    return (char *)block + sizeof(arenablock_t);
+}
+
+void *arenaAllocate(arena_t *arena, size_t size) {
+    void *ptr;
+
+    if(size == 0) size = 1; // always return a unique pointer, like malloc
+    size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+
+    // Large allocations get a block of their own, keeping the slack in the current block
+    if(size > ARENA_BLOCKSIZE / 4) return _arenaBlock(arena, size);
+
+    if(size > arena->remaining) {
+        arena->ptr = _arenaBlock(arena, ARENA_BLOCKSIZE);
+        if(arena->ptr == NULL) {
+            arena->remaining = 0;
+            return NULL;
+        }
+        arena->remaining = ARENA_BLOCKSIZE;
+    }
+    ptr = arena->ptr;
+    arena->ptr += size;
+    arena->remaining -= size;
+    return ptr;
+}
+
+// allocate a string, copy content and return pointer, or NULL if no memory
+char *arenaString(arena_t *arena, const char *str) {
+    char *ptr = (char *)arenaAllocate(arena, strlen(str) + 1);
+    if(ptr) {
+        strcpy(ptr, str);
+    }
+    return ptr;
+}
+
+// Release all blocks at once
+void freeArena(arena_t *arena) {
+    arenablock_t *block, *next;
+
+    for(block = (arenablock_t *)arena->blocks; block; block = next) {
+        next = block->next;
+        free(block);
+    }
+    arena->blocks = NULL;
+    arena->ptr = NULL;
+    arena->remaining = 0;
+}
@@ -0,0 +1,11 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "defines.h"
+
+void  initArena(arena_t *arena, uint24_t *bytecounter); // releases any earlier blocks
+void *arenaAllocate(arena_t *arena, size_t size);
+char *arenaString(arena_t *arena, const char *str);
+void  freeArena(arena_t *arena);
+
+#endif // ARENA_H
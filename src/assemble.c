@@ -14,8 +14,12 @@
 #include "moscalls.h"
 #include "hash.h"
 #include "str2num.h"
+#include "arena.h"
 #include "assemble.h"
 #include "console.h"
+#include "fixup.h"
+#include "expression.h"
+#include "includecache.h"
 // linebuffer for replacement arguments during macro expansion
 char macro_expansionbuffer[MACROLINEMAX + 1];
 
@@ -39,25 +43,19 @@ contentitem_t *insertContent(const char *filename) {
     uint8_t index;
 
     // Allocate memory and fill out ci content
-    ci = allocateMemory(sizeof(contentitem_t), &filecontentsize);
+    ci = arenaAllocate(&contentarena, sizeof(contentitem_t));
     if(ci == NULL) return NULL;
-    ci->name = allocateString(filename, &filecontentsize);
+    ci->name = arenaString(&contentarena, filename);
     if(ci->name == NULL) return NULL;
+    ci->mapped = false;
+    ci->replayed = false;
 
     if(completefilebuffering) {
-        ci->fh = ioOpenfile(filename, "rb");
-        if(ci->fh == 0) return NULL;
-        ci->size = ioGetfilesize(ci->fh);
-        ci->buffer = allocateMemory(ci->size+1, &filecontentsize);
-        if(ci->buffer == NULL) return NULL;
-        if(fread(ci->buffer, 1, ci->size, ci->fh) != ci->size) {
-            error(message[ERROR_READINGINPUT],0);
-            return NULL;
-        }
-        ci->buffer[ci->size] = 0; // terminate stringbuffer
-        fclose(ci->fh);
+        if(!ioReadContent(ci)) return NULL;
     }
     strcpy(ci->labelscope, ""); // empty scope
+    ci->lineinfo = NULL;
+    ci->linecount = 0;
     ci->next = NULL;
 
     // Placement
@@ -81,6 +79,24 @@ contentitem_t *insertContent(const char *filename) {
     }
 }
 
+// Allocate storage for the first pass results of each line in a fully buffered source file
+void initLineInfo(contentitem_t *ci) {
+    uint24_t lines = 1;
+    char *ptr = ci->buffer;
+    char *end = ci->buffer + ci->size;
+
+    while((ptr = memchr(ptr, '\n', end - ptr))) {
+        ptr++;
+        lines++;
+    }
+    if(lines >= 0xFFFF) return; // line numbers are 16-bit, no reuse for larger files
+
+    ci->lineinfo = (lineinfo_t *)arenaAllocate(&contentarena, (lines + 1) * sizeof(lineinfo_t));
+    if(ci->lineinfo == NULL) return;
+    memset(ci->lineinfo, 0, (lines + 1) * sizeof(lineinfo_t));
+    ci->linecount = lines;
+}
+
 // Parse a command-token string to currentline.mnemonic & currentline.suffix
 void parse_command(char *src) {
     currentline.mnemonic = src;
@@ -476,7 +492,12 @@ void parseLine(char *src) {
                 }
                 else parse_command(streamtoken.start); // ez80 split suffix and set mnemonic for search
 
-                currentline.current_instruction = instruction_lookup(currentline.mnemonic);
+                if(currentlineinfo && currentlineinfo->instruction) {
+                    // resolved on this same source line during the first pass
+                    currentline.current_instruction = currentlineinfo->instruction;
+                    if(asmcmd && (currentline.current_instruction->type == ASSEMBLER)) currentline.mnemonic = streamtoken.start + 1;
+                }
+                else currentline.current_instruction = instruction_lookup(currentline.mnemonic);
                 if(currentline.current_instruction == NULL) {
                     if(!asmcmd) {
                         error(message[ERROR_INVALIDMNEMONIC],"%s",currentline.mnemonic);
@@ -492,6 +513,7 @@ void parseLine(char *src) {
                     }
                     // Valid assembler command found (with a .)
                 }
+                if(currentlineinfo) currentlineinfo->instruction = currentline.current_instruction;
                 if((streamtoken.terminator == ';') || (streamtoken.terminator == 0)) 
                     currentline.next = NULL;
                 else currentline.next = streamtoken.next;
@@ -518,8 +540,7 @@ void parseLine(char *src) {
             case PS_OP:
                 argcount++;   
                 if(currentExpandedMacro) {
-                    macroExpandArg(macro_expansionbuffer, streamtoken.start, currentExpandedMacro);
-                    streamtoken.start = macro_expansionbuffer;
+                    streamtoken.start = macroExpandArg(macro_expansionbuffer, streamtoken.start, currentExpandedMacro);
                     oplength = strlen(streamtoken.start);
                 }
                 // Only actually parse operands if we are in NORMAL/TRUE conditional state
@@ -592,8 +613,7 @@ bool parse_asm_single_immediate(void) {
         return false;
     }
     if(currentExpandedMacro) {
-        macroExpandArg(macro_expansionbuffer, currentline.next, currentExpandedMacro);
-        currentline.next = macro_expansionbuffer;
+        currentline.next = macroExpandArg(macro_expansionbuffer, currentline.next, currentExpandedMacro);
     }
     if(getOperandToken(&token, currentline.next) == 0) {
         error(message[ERROR_MISSINGARGUMENT],0);
@@ -610,10 +630,33 @@ bool parse_asm_single_immediate(void) {
 }
 
 // Emits list data for the DB/DW/DW24/DW32 etc directives
+// Numeric literals are converted directly, anything else is evaluated as an expression
+// The values collected so far are emitted before an expression that can refer to '$',
+// so the current address is that of the item itself
+int32_t _dataValue(char *str, uint8_t *data, uint24_t *datalength) {
+    int32_t value;
+    size_t length;
+
+    if(numberStart(str[0]) && !((str[0] == '$') && (str[1] == 0))) {
+        length = strlen(str);
+        if(length <= TOKEN_MAX) {
+            value = str2num(str, length);
+            if(!err_str2num) return value;
+        }
+    }
+    if(strchr(str, '$')) {
+        emit_bytes(data, *datalength);
+        *datalength = 0;
+    }
+    return getExpressionValue(str, REQUIRED_LASTPASS);
+}
+
 void handle_asm_data(uint8_t wordtype) {
     int32_t value;
     streamtoken_t token;
     bool expectarg = true;
+    uint8_t data[LINEMAX];          // values are collected here and emitted as a single run
+    uint24_t length = 0;
 
     if(inConditionalSection == CONDITIONSTATE_FALSE) return;
 
@@ -622,41 +665,54 @@ void handle_asm_data(uint8_t wordtype) {
     while(currentline.next) {
         if(getDefineValueToken(&token, currentline.next)) {
             if(currentExpandedMacro) {
-                macroExpandArg(macro_expansionbuffer, token.start, currentExpandedMacro);
-                token.start = macro_expansionbuffer;
+                token.start = macroExpandArg(macro_expansionbuffer, token.start, currentExpandedMacro);
             }
 
             if((token.start[0] == '\"') && (wordtype != ASM_DB)) {
+                emit_bytes(data, length);
                 error(message[ERROR_STRING_NOTALLOWED],0);
                 return;
             }
 
+            if(length > (LINEMAX - 4)) {
+                emit_bytes(data, length);
+                length = 0;
+            }
+
             switch(wordtype) {
                 case ASM_DB:
                     switch(token.start[0]) {
                         case '\"':
+                            emit_bytes(data, length);
+                            length = 0;
                             emit_quotedstring(token.start);
                             break;
                         default:
-                            value = getExpressionValue(token.start, REQUIRED_LASTPASS); // not needed in pass 1
-                            if(pass == ENDPASS) validateRange8bit(value, token.start);
-                            emit_8bit(value);
+                            value = _dataValue(token.start, data, &length);
+                            if(finalValues()) validateRange8bit(value, token.start);
+                            data[length++] = value;
                             break;
                     }
                     break;
                 case ASM_DW:
-                    value = getExpressionValue(token.start, REQUIRED_LASTPASS);
-                    if(pass == ENDPASS) validateRange16bit(value, token.start);
-                    emit_16bit(value);
+                    value = _dataValue(token.start, data, &length);
+                    if(finalValues()) validateRange16bit(value, token.start);
+                    data[length++] = value & 0xFF;
+                    data[length++] = (value >> 8) & 0xFF;
                     break;
                 case ASM_DW24:
-                    value = getExpressionValue(token.start, REQUIRED_LASTPASS);
-                    if(pass == ENDPASS) validateRange24bit(value, token.start);
-                    emit_24bit(value);
+                    value = _dataValue(token.start, data, &length);
+                    if(finalValues()) validateRange24bit(value, token.start);
+                    data[length++] = value & 0xFF;
+                    data[length++] = (value >> 8) & 0xFF;
+                    data[length++] = (value >> 16) & 0xFF;
                     break;
                 case ASM_DW32:
-                    value = getExpressionValue(token.start, REQUIRED_LASTPASS);
-                    emit_32bit(value);
+                    value = _dataValue(token.start, data, &length);
+                    data[length++] = value & 0xFF;
+                    data[length++] = (value >> 8) & 0xFF;
+                    data[length++] = (value >> 16) & 0xFF;
+                    data[length++] = (value >> 24) & 0xFF;
                     break;
                 default:
                     error(message[ERROR_INTERNAL],0);
@@ -677,6 +733,7 @@ void handle_asm_data(uint8_t wordtype) {
             currentline.next = NULL;
         }
     }
+    emit_bytes(data, length);
     if(expectarg) error(message[ERROR_MISSINGARGUMENT],0);
 }
 
@@ -724,8 +781,7 @@ void handle_asm_adl(void) {
         return;
     }
     if(currentExpandedMacro) {
-        macroExpandArg(macro_expansionbuffer, token.start, currentExpandedMacro);
-        token.start = macro_expansionbuffer;
+        token.start = macroExpandArg(macro_expansionbuffer, token.start, currentExpandedMacro);
     }
     if(strcasecmp(token.start, "adl")) {
         error(message[ERROR_INVALIDOPERAND],0);
@@ -779,7 +835,7 @@ void handle_asm_org(void) {
         return;
     }
     // Fill bytes on any subsequent .org statement
-    while(address != newaddress) emit_8bit(fillbyte);
+    emit_fill(fillbyte, newaddress - address);
 }
 
 void handle_asm_include(void) {
@@ -815,10 +871,24 @@ void handle_asm_include(void) {
     sourcefilecount++;
 }
 
+// Optional offset / length argument to incbin, needed during pass 1
+bool _getIncbinArgument(streamtoken_t *token, uint24_t *value) {
+    if(getDefineValueToken(token, token->next) == 0) {
+        error(message[ERROR_MISSINGARGUMENT],0);
+        return false;
+    }
+    if(currentExpandedMacro) {
+        token->start = macroExpandArg(macro_expansionbuffer, token->start, currentExpandedMacro);
+    }
+    *value = getExpressionValue(token->start, REQUIRED_FIRSTPASS);
+    return true;
+}
+
 void handle_asm_incbin(void) {
     streamtoken_t token;
     contentitem_t *ci;
-    uint24_t n;
+    FILE *fh;
+    uint24_t offset, length;
 
     if(inConditionalSection == CONDITIONSTATE_FALSE) return;
 
@@ -833,8 +903,7 @@ void handle_asm_incbin(void) {
     }
 
     if(currentExpandedMacro) {
-        macroExpandArg(macro_expansionbuffer, token.start, currentExpandedMacro);
-        token.start = macro_expansionbuffer;
+        token.start = macroExpandArg(macro_expansionbuffer, token.start, currentExpandedMacro);
     }
     if(token.start[0] != '\"') {
         error(message[ERROR_STRINGFORMAT],0);
@@ -853,43 +922,58 @@ void handle_asm_incbin(void) {
         else return;
     }
 
-    if(pass == STARTPASS) {
-        if(!completefilebuffering) {
-            ci->fh = ioOpenfile(ci->name, "rb");
-            if(ci->fh == 0) return;
-            ci->size = ioGetfilesize(ci->fh);
-            fclose(ci->fh);
+    // Use a separate filehandle, the file might also be an open source file
+    if((pass == STARTPASS) && !completefilebuffering) {
+        fh = ioOpenfile(ci->name, "rb");
+        if(fh == 0) return;
+        ci->size = ioGetfilesize(fh);
+        fclose(fh);
+    }
+
+    // Optional part of the file, as offset[,length]
+    offset = 0;
+    length = ci->size;
+    if(token.terminator == ',') {
+        if(!_getIncbinArgument(&token, &offset)) return;
+        length = (offset <= ci->size) ? ci->size - offset : 0;
+        if(token.terminator == ',') {
+            if(!_getIncbinArgument(&token, &length)) return;
         }
-        address += ci->size;
     }
-    if(pass == ENDPASS) {
-        if(completefilebuffering) {
-            if(listing) { // Output needs to pass to the listing through emit_8bit, performance-hit
-                for(n = 0; n < ci->size; n++) emit_8bit(ci->buffer[n]);
+    if((offset > ci->size) || (length > ci->size - offset)) {
+        error(message[ERROR_INCBINRANGE],"%s",ci->name);
+        return;
+    }
+
+    if((pass == STARTPASS) && !singlepass) address += length;
+    if((pass == ENDPASS) || singlepass) {
+        if(listing) { // Output needs to pass to the listing
+            if(completefilebuffering) {
+                emit_bytes((uint8_t *)ci->buffer + offset, length);
             }
             else {
-                ioWrite(FILE_OUTPUT, ci->buffer, ci->size);
-                address += ci->size;
+                char buffer[INPUT_BUFFERSIZE];
+
+                uint24_t bytesread;
+
+                fh = ioOpenfile(ci->name, "rb");
+                if(fh == 0) return;
+                fseek(fh, offset, SEEK_SET);
+                while(length) {
+                    bytesread = fread(buffer, 1, (length < INPUT_BUFFERSIZE) ? length : INPUT_BUFFERSIZE, fh);
+                    if(bytesread == 0) break;
+                    emit_bytes((uint8_t *)buffer, bytesread);
+                    length -= bytesread;
+                }
+                fclose(fh);
             }
         }
-        else {
-            char buffer[INPUT_BUFFERSIZE];
-
-            ci->fh = ioOpenfile(ci->name, "rb");
-            if(ci->fh == 0) return;
-            while(true) {
-                ci->bytesinbuffer = fread(buffer, 1, INPUT_BUFFERSIZE, ci->fh);
-                if(ci->bytesinbuffer == 0) break;
-                if(listing) { // Output needs to pass to the listing through emit_8bit, performance-hit
-                    for(n = 0; n < ci->bytesinbuffer; n++) emit_8bit(buffer[n]);
-                }
-                else {
-                    ioWrite(FILE_OUTPUT, buffer, ci->bytesinbuffer);
-                    address += ci->bytesinbuffer;
-                }
+        else { // Copy directly from the file to the output file
+            if(!ioCopyFile(ci->name, offset, length)) {
+                error(message[ERROR_READINGBINFILE],"%s",ci->name);
+                return;
             }
-            fclose(ci->fh);
-            ci->fh = NULL;
+            address += length;
         }
     }
     binfilecount++;
@@ -916,8 +1000,7 @@ void handle_asm_blk(uint8_t width) {
     }
 
     if(currentExpandedMacro) {
-        macroExpandArg(macro_expansionbuffer, token.start, currentExpandedMacro);
-        token.start = macro_expansionbuffer;
+        token.start = macroExpandArg(macro_expansionbuffer, token.start, currentExpandedMacro);
     }
 
     num = getExpressionValue(token.start, REQUIRED_FIRSTPASS); // <= needs a number of items during pass 1, otherwise addresses will be off later on
@@ -929,8 +1012,7 @@ void handle_asm_blk(uint8_t width) {
         }
 
         if(currentExpandedMacro) {
-            macroExpandArg(macro_expansionbuffer, token.start, currentExpandedMacro);
-            token.start = macro_expansionbuffer;
+            token.start = macroExpandArg(macro_expansionbuffer, token.start, currentExpandedMacro);
         }
         val = getExpressionValue(token.start, REQUIRED_LASTPASS); // value not required in pass 1
     }
@@ -948,17 +1030,17 @@ void handle_asm_blk(uint8_t width) {
                 if(val != fillbyte) warning(message[WARNING_UNSUPPORTED_INITIALIZER],"%s",token.start);
                 break;
             case 1:
-                if(pass == ENDPASS) validateRange8bit(val, token.start);
-                emit_8bit(val);
-                num -= 1;
+                if(finalValues()) validateRange8bit(val, token.start);
+                emit_fill(val, num);
+                num = 0;
                 break;
             case 2:
-                if(pass == ENDPASS) validateRange16bit(val, token.start);
+                if(finalValues()) validateRange16bit(val, token.start);
                 emit_16bit(val);
                 num -= 1;
                 break;
             case 3:
-                if(pass == ENDPASS) validateRange24bit(val, token.start);
+                if(finalValues()) validateRange24bit(val, token.start);
                 emit_24bit(val);
                 num -= 1;
                 break;
@@ -1131,6 +1213,18 @@ void handle_asm_endrelocate(void) {
 }
 
 void handle_assembler_command(void) {
+    switch(currentline.current_instruction->asmtype) {
+        case(ASM_DB):
+        case(ASM_DW):
+        case(ASM_DW24):
+        case(ASM_DW32):
+        case(ASM_ASCIZ):
+            break;
+        default:
+            macroExpansionPure = false; // other directives change or depend on the assembler state
+            break;
+    }
+
     switch(currentline.current_instruction->asmtype) {
         case(ASM_ADL):
             handle_asm_adl();
@@ -1214,13 +1308,70 @@ void handle_assembler_command(void) {
     return;
 }
 
+// Check if the parsed operands match the given operandlist entry
+bool operandsMatch(const operandlist_t *list) {
+    bool condmatch;
+    bool regamatch, regbmatch;
+
+    regamatch = (list->regsetA & operand1.reg) || !(list->regsetA | operand1.reg);
+    regbmatch = (list->regsetB & operand2.reg) || !(list->regsetB | operand2.reg);
+
+    condmatch = ((list->conditionsA & MODECHECK) == operand1.addressmode) && ((list->conditionsB & MODECHECK) == operand2.addressmode);
+    if(list->flags & F_CCOK) {
+        condmatch |= operand1.cc;
+        regamatch = true;
+    }
+    return regamatch && regbmatch && condmatch;
+}
+
+// Matches by instruction and operand signature. The match only depends on the
+// operand registers, addressing modes and condition code, not on the cpu type.
+// Entries point into the static operand lists and stay valid
+operandcache_t operandCache[OPERAND_CACHE_SIZE];
+
+// Find the first operandlist entry of the current instruction that matches the parsed operands
+// A match from the first pass is re-used when it still applies to the current instruction
+operandlist_t *findOperandMatch(void) {
+    instruction_t *instruction = currentline.current_instruction;
+    operandlist_t *list = instruction->list;
+    operandcache_t *cached;
+    uint8_t modes = (operand1.addressmode << 4) | operand2.addressmode;
+    uint24_t h;
+    uint8_t listitem;
+
+    if(currentlineinfo && currentlineinfo->operands) {
+        if((currentlineinfo->operands >= list) &&
+           (currentlineinfo->operands < list + instruction->listnumber) &&
+           operandsMatch(currentlineinfo->operands)) return currentlineinfo->operands;
+    }
+
+    h = (uint24_t)((uintptr_t)list / sizeof(operandlist_t)) ^ operand1.reg ^ (operand2.reg << 5) ^ ((uint24_t)modes << 11) ^ operand1.cc;
+    cached = &operandCache[(h ^ (h >> 10)) & (OPERAND_CACHE_SIZE - 1)];
+    if(cached->operands && (cached->instruction == instruction) && (cached->regA == operand1.reg) &&
+       (cached->regB == operand2.reg) && (cached->modes == modes) && (cached->cc == operand1.cc)) {
+        if(currentlineinfo) currentlineinfo->operands = cached->operands;
+        return cached->operands;
+    }
+
+    for(listitem = 0; listitem < instruction->listnumber; listitem++) {
+        if(operandsMatch(list)) {
+            if(currentlineinfo) currentlineinfo->operands = list;
+            cached->instruction = instruction;
+            cached->regA = operand1.reg;
+            cached->regB = operand2.reg;
+            cached->modes = modes;
+            cached->cc = operand1.cc;
+            cached->operands = list;
+            return list;
+        }
+        list++;
+    }
+    return NULL;
+}
+
 // Process the instructions found at each line, after parsing them
 void processInstructions(void){
     operandlist_t *list;
-    uint8_t listitem;
-    bool match;
-    bool condmatch;
-    bool regamatch, regbmatch;
 
     if((currentline.mnemonic == NULL) && (inConditionalSection != CONDITIONSTATE_FALSE)) definelabel(address);
 
@@ -1228,29 +1379,16 @@ void processInstructions(void){
         if(currentline.current_instruction->type == EZ80) {
             if(inConditionalSection != CONDITIONSTATE_FALSE) {
                 // process this mnemonic by applying the instruction list as a filter to the operand-set
-                list = currentline.current_instruction->list;
-                match = false;
-                for(listitem = 0; listitem < currentline.current_instruction->listnumber; listitem++) {
-                    regamatch = (list->regsetA & operand1.reg) || !(list->regsetA | operand1.reg);
-                    regbmatch = (list->regsetB & operand2.reg) || !(list->regsetB | operand2.reg);
-
-                    condmatch = ((list->conditionsA & MODECHECK) == operand1.addressmode) && ((list->conditionsB & MODECHECK) == operand2.addressmode);
-                    if(list->flags & F_CCOK) {
-                        condmatch |= operand1.cc;
-                        regamatch = true;
-                    }
-                    if(regamatch && regbmatch && condmatch) {
-                        match = true;
-                        if(!(cputype & list->cpu)) {
-                            errorCPUtype(ERROR_INVALID_CPU_INSTRUCTION);
-                            break;
-                        }
-                        emit_instruction(list);
-                        break;
-                    }
-                    list++;
+                list = findOperandMatch();
+                if(!list) {
+                    error(message[ERROR_OPERANDSNOTMATCHING],0);
+                    return;
                 }
-                if(!match) error(message[ERROR_OPERANDSNOTMATCHING],0);
+                if(!(cputype & list->cpu)) {
+                    errorCPUtype(ERROR_INVALID_CPU_INSTRUCTION);
+                    return;
+                }
+                emit_instruction(list);
                 return;
             }
         }
@@ -1268,9 +1406,14 @@ void processMacro(void) {
     bool macro_invocation_warning = false;
     uint24_t localmacroExpandID;
     bool processednestedmacro = false;
+    macrocache_t *expansion = NULL;
+    uint24_t startaddress, capturestart = 0;
 
     if((listing) && (pass == ENDPASS)) listEndLine();
 
+    // Macro body lines are expanded differently for each invocation
+    currentlineinfo = NULL;
+
     // Set counters and local expansion scope
     macrolevel++;
     if(pass == STARTPASS) macroexpansions++;
@@ -1282,13 +1425,26 @@ void processMacro(void) {
 
     // potentially transform arguments first, when calling from within a macro
     if(currentExpandedMacro) {
-        macroExpandArg(macro_expansionbuffer, currentline.next, currentExpandedMacro);
-        currentline.next = macro_expansionbuffer;
+        currentline.next = macroExpandArg(macro_expansionbuffer, currentline.next, currentExpandedMacro);
     }
     currentExpandedMacro = localexpandedmacro;
 
     if(!(parseMacroArguments(localexpandedmacro, currentline.next, substitutionlist))) return;
 
+    // Repeat an earlier expansion with the same arguments, if its result didn't depend on the assembler state
+    if((inConditionalSection != CONDITIONSTATE_FALSE) && !(listing && (pass == ENDPASS))) {
+        expansion = findMacroExpansion(localexpandedmacro);
+        if(expansion && replayMacroExpansion(expansion)) {
+            currentExpandedMacro = NULL;
+            macroExpansionPure = false; // for a calling macro
+            macrolevel--;
+            return;
+        }
+        if(expansion) capturestart = macroCaptureStart();
+    }
+    startaddress = address;
+    macroExpansionPure = true;
+
     // open macro storage
     macrolineptr = localexpandedmacro->body;
 
@@ -1297,9 +1453,14 @@ void processMacro(void) {
     lastmacrolineptr = macrolineptr;
     while(getnextMacroLine(&macrolineptr, macroline)) {
         if(pass == ENDPASS && (listing)) listStartLine(macroline, macrolinenumber);
+        if(singlepass) fixupLineStart(lastmacrolineptr);
+        setMacroLine(localexpandedmacro, lastmacrolineptr, macroline);
         parseLine(macroline);
 
-        if(!currentline.current_macro) processInstructions();
+        if(!currentline.current_macro) {
+            processInstructions();
+            if(singlepass) fixupLineEnd();
+        }
         else {
             // CALL nested macro instruction
             if(macrolevel >= MACRO_MAXLEVEL) {
@@ -1321,8 +1482,7 @@ void processMacro(void) {
             }
             getnextMacroLine(&lastmacrolineptr, macroline);
             trimRight(macroline);
-            macroExpandArg(macro_expansionbuffer, macroline, localexpandedmacro);
-            colorPrintf(YELLOW, "%s\n",macro_expansionbuffer);
+            colorPrintf(YELLOW, "%s\n", macroExpandArg(macro_expansionbuffer, macroline, localexpandedmacro));
             if(issue_warning) {
                 macro_invocation_warning = true; // flag to upstream caller that there was at least a single warning
                 issue_warning = false; // disable further LOCAL warnings until they occur
@@ -1335,12 +1495,97 @@ void processMacro(void) {
         lastmacrolineptr = macrolineptr;
     }
     // end processing
+    if(expansion) recordMacroExpansion(expansion, address - startaddress, capturestart, macroExpansionPure && !macro_invocation_warning);
+    macroExpansionPure = false; // for a calling macro
     currentExpandedMacro = NULL;
     if(macro_invocation_warning) issue_warning = true; // display invocation warning at upstream caller
 
     macrolevel--;
 }
 
+// Classify a raw content line by its command, after an optional label
+skipline_t _skipLineType(const char *ptr, const char *end) {
+    const char *start;
+    size_t length;
+
+    while(true) {
+        while((ptr < end) && isspace(*ptr) && (*ptr != '\n')) ptr++;
+        start = ptr;
+        while((ptr < end) && *ptr && !isspace(*ptr) && (*ptr != ';') && (*ptr != ':')) ptr++;
+        if((ptr < end) && (*ptr == ':') && (ptr != start)) { // label
+            ptr++;
+            continue;
+        }
+        break;
+    }
+    if((start < end) && (*start == '.')) start++;
+    length = ptr - start;
+
+    if(((length == 2) && (strncasecmp(start, "if", 2) == 0)) ||
+       ((length == 4) && (strncasecmp(start, "else", 4) == 0)) ||
+       ((length == 5) && (strncasecmp(start, "endif", 5) == 0))) return SKIP_CONDITIONAL;
+    if((length == 5) && (strncasecmp(start, "macro", 5) == 0)) return SKIP_MACRO;
+    if((length == 8) && (strncasecmp(start, "endmacro", 8) == 0)) return SKIP_ENDMACRO;
+    return SKIP_NONE;
+}
+
+// Skip the lines in a false conditional section, without parsing them, up to the next line
+// with a conditional directive. Macro definitions in the section are skipped as a whole.
+// Returns false if reading a line failed
+bool _skipConditionalSection(contentitem_t *ci) {
+    char *ptr = ci->readptr;
+    char *end = ci->buffer + ci->size; // buffer might not be zero-terminated
+    char *next;
+    char line[LINEMAX+1];
+    bool inmacro = false;
+    skipline_t type;
+    size_t length;
+    uint24_t position;
+
+    if(!completefilebuffering) { // read line by line, seek back to the line that ends the section
+        while(true) {
+            position = ci->filepos;
+            if(getnextContentLine(line, ci) == 0) return (errorcount == 0);
+            type = _skipLineType(line, line + strlen(line));
+            if(!inmacro && (type == SKIP_CONDITIONAL)) {
+                seekContentInput(ci, position);
+                return true;
+            }
+            if(type == SKIP_MACRO) inmacro = true;
+            if(type == SKIP_ENDMACRO) inmacro = false;
+            ci->currentlinenumber++;
+            if((listing) && (pass == ENDPASS)) {
+                listStartLine(line, ci->currentlinenumber);
+                listEndLine();
+            }
+        }
+    }
+
+    // scan the complete content buffer directly
+    while((ptr < end) && *ptr) {
+        next = memchr(ptr, '\n', end - ptr);
+        next = next ? next + 1 : end;
+
+        type = _skipLineType(ptr, next);
+        if(!inmacro && (type == SKIP_CONDITIONAL)) break;
+        if(type == SKIP_MACRO) inmacro = true;
+        if(type == SKIP_ENDMACRO) inmacro = false;
+
+        ci->currentlinenumber++;
+        if((listing) && (pass == ENDPASS)) {
+            length = ((next - ptr) > LINEMAX) ? LINEMAX : (next - ptr);
+            memcpy(line, ptr, length);
+            line[length] = 0;
+            listStartLine(line, ci->currentlinenumber);
+            listEndLine();
+        }
+        ptr = next;
+    }
+    ci->filepos += ptr - ci->readptr;
+    ci->readptr = ptr;
+    return true;
+}
+
 bool increasecontentlevel(void) {
     if(++contentlevel == MAXPROCESSDEPTH) {
         error(message[ERROR_MAXINCLUDEFILES], "%d", MAXPROCESSDEPTH);
@@ -1370,15 +1615,35 @@ void processContent(const char *filename) {
         }
         else return;
     }
-    openContentInput(ci, iobuffer);
+    if(ci->replayed && (pass == ENDPASS)) { // definitions were replayed from the include cache
+        decreasecontentlevel();
+        return;
+    }
+    if((pass == STARTPASS) && (contentlevel > 1) && includeCacheEnabled()) {
+        if(includeCacheReplay(ci)) {
+            decreasecontentlevel();
+            return;
+        }
+        includeCacheRecord(ci);
+    }
+    if((pass == STARTPASS) && completefilebuffering && (ci->lineinfo == NULL)) initLineInfo(ci);
+    if(!openContentInput(ci, iobuffer)) {
+        decreasecontentlevel();
+        return;
+    }
     // Process
     while(getnextContentLine(line, ci)) {
         ci->currentlinenumber++;
+        currentlineinfo = (ci->currentlinenumber <= ci->linecount) ? &ci->lineinfo[ci->currentlinenumber] : NULL;
         if((listing) && (pass == ENDPASS)) listStartLine(line, ci->currentlinenumber);
+        if(singlepass) fixupLineStart(ci->readptr - ci->lastreadlength);
 
         parseLine(line);
 
-        if(!currentline.current_macro) processInstructions();
+        if(!currentline.current_macro) {
+            processInstructions();
+            if(singlepass) fixupLineEnd();
+        }
         else {
             processMacro();
             processedmacro = true;
@@ -1398,11 +1663,13 @@ void processContent(const char *filename) {
             }
         }
         if((listing) && (pass == ENDPASS)) listEndLine();
+        if((inConditionalSection == CONDITIONSTATE_FALSE) && !_skipConditionalSection(ci)) break;
     }
     if(inConditionalSection != CONDITIONSTATE_NORMAL) {
         error(message[ERROR_MISSINGENDIF],0);
         return;
     }
+    if(includerecording) includeCacheEnd(ci);
     closeContentInput(ci, callerci);
     decreasecontentlevel();
     strcpy(ci->labelscope, ""); // empty scope for next pass
@@ -1419,27 +1686,60 @@ void passInitialize(uint8_t passnumber) {
     binfilecount = 0;
     issue_warning = false;
     remaining_dsspaces = 0;
+    forwardreference = false;
     macrolevel = 0;
     macroExpandID = 0;
     relocate = false;
     relocateOutputBaseAddress = 0;
     relocateBaseAddress = 0;
     currentcontentitem = NULL;
+    currentlineinfo = NULL;
 
     initAnonymousLabelTable();
         if(pass == ENDPASS) {
-        fseek(filehandle[FILE_ANONYMOUS_LABELS], 0, 0);
-        readAnonymousLabel();
+        seekAnonymousLabel(0);
         listInit();
     }
 }
 
+// Reset all assembler state for a new assembly, after the options have been set
+void initAssembler(void) {
+    initGlobalLabelTable();
+    initMacros();
+    initExpressions();
+    initFileContentTable();
+    initIncludeCache();
+    sourcefilecount = 0;
+    binfilecount = 0;
+    errorcount = 0;
+    errorreportlevel = 0;
+    maxstackdepth = 0;
+    macroexpansions = 0;
+    cputype = CPU_EZ80;
+    listing = list_enabled || consolelist_enabled;
+    if(singlepass && (listing || !completefilebuffering)) {
+        fprintf(messageoutput, "Single pass assembly unavailable with listing or minimum memory configuration\n");
+        singlepass = false;
+    }
+}
+
 void assemble(const char *filename) {
 
+    if(singlepass) {
+        fprintf(messageoutput, "Pass %d...\n", STARTPASS);
+        initFixups();
+        passInitialize(STARTPASS);
+        processContent(filename);
+        if(errorcount) return;
+        fprintf(messageoutput, "Patching %d forward references...\n", fixupCounter);
+        processFixups();
+        return;
+    }
     for(uint8_t p = STARTPASS; p <= ENDPASS; p++) {
-        printf("Pass %d...\n", p);
+        fprintf(messageoutput, "Pass %d...\n", p);
         passInitialize(p);
         processContent(filename);
+        if(listing && (p == ENDPASS)) listFlush();
         if(errorcount) return;
     }
 }
@@ -4,7 +4,12 @@
 #include "config.h"
 #include "defines.h"
 
+void initAssembler(void);
 void assemble(const char *filename);
 void processContent(const char *filename);
+void parseLine(char *src);
+void processInstructions(void);
+
+extern char macro_expansionbuffer[MACROLINEMAX + 1];
 
 #endif // ASSEMBLE_H
\ No newline at end of file
@@ -16,8 +16,15 @@
 #define FILLBYTE                   0xFF // Same as ZDS
 #define STARTPASS                     1
 #define ENDPASS                       2
-#define INSTRUCTION_HASHTABLESIZE   256 // Number of entries in the hashtable
-#define GLOBAL_LABEL_TABLE_SIZE     256
+#define MACRO_HASHTABLESIZE         256 // Number of entries in the macro hashtable
+#define MACROCACHE_HASHTABLESIZE    256 // Number of entries in the macro expansion cache hashtable, power of 2
+#define GLOBAL_LABEL_TABLE_SIZE     256 // Initial number of entries, doubles when the number of labels reaches twice the size
+#define GLOBAL_LABEL_TABLE_MAXSIZE 65536 // Limited by the 16-bit label hash
+#define ARENA_BLOCKSIZE            4096 // Memory is allocated in blocks of this size, per subsystem
+#define OPERAND_CACHE_SIZE         1024 // Entries in the operand signature cache, power of 2
+#define EXPRESSION_HASHTABLESIZE   1024 // Number of entries in the compiled expression hashtable, power of 2
+#define EXPRESSION_MAXTERMS          32 // Longer expressions aren't compiled
+#define ANONYMOUS_LABEL_TABLE_START  64 // Initial number of anonymous labels, the table grows when needed
 #define MAXPROCESSDEPTH               8 // Maximum simultaneous processing 'depth' of files / include files
 #define MACRO_MAXLEVEL                8 // Maximum depth level of recursive macro calling
 #define LINEMAX                     256 // Maximum characters per line in input file
@@ -26,6 +33,11 @@
 #define OUTPUT_BUFFERSIZE         32768 // For each specified output file (io.c)
 #define INPUT_BUFFERSIZE           1024 // For minimally buffered input files
 #define LISTING_OBJECTS_PER_LINE      4 // Listing hex 'objects' between PC / Line number
+#define LISTING_LOGSIZE           16384 // Listing records collected before they are formatted (listing.c)
+#define SERVER_REQUESTMAX          4096 // Maximum size of a request in server mode (server.c)
+#define SERVER_MAXARGS               64 // Maximum command line arguments in a request
+#define SERVER_BACKLOG                8 // Pending connections in server mode
+#define WATCH_SETTLETIME             50 // Milliseconds without further changes before reassembly (watch.c)
 #define TOKEN_MAX               LINEMAX // Token maximum length
 #define MAXNAMELENGTH                64 // Maximum name length of labels
 #define MACROMAXARGS                  8 // Maximum arguments to a macro
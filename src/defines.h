@@ -148,23 +148,6 @@ typedef enum {
 #define CODE_SIL    0x52
 #define CODE_LIL    0x5B
 
-typedef struct contentitem {
-    // Static items
-    char*           name;                         // name of the file
-    unsigned int    size;                         // size of the file
-    char*           buffer;                       // pointer to 1) full file content OR 2) partial content during minimal buffering
-    FILE*           fh;                           // filehandle
-    void*           next;
-    // Items changed during processing
-    char*           readptr;
-    uint24_t        filepos;                      // The current VIRTUAL position in a buffered file to read from. Needed for fseek purposes        
-    uint16_t        lastreadlength;
-    uint16_t        currentlinenumber;
-    char            labelscope[MAXNAMELENGTH+1];
-    uint8_t         inConditionalSection;
-    unsigned int    bytesinbuffer;                // only used during minimal input buffering
-} contentitem_t;
-
 typedef struct {
     uint24_t        reg;
     uint8_t         reg_index;
@@ -208,6 +191,12 @@ typedef struct {
     uint8_t         opcode;             // base opcode, may be transformed by A/B, according to opcodetransformtype
 } operandlist_t;
 
+// Argument occurrence in a macro body, located when the macro is defined
+typedef struct {
+    uint16_t        offset;                       // from the start of the body
+    uint8_t         argument;
+} macroslot_t;
+
 typedef struct {
     char*           name;
     char*           originfilename;
@@ -218,8 +207,28 @@ typedef struct {
     char**          substitutions;
     void*           next;
    uint24_t         currentExpandID;
+    macroslot_t*    slots;                        // argument occurrences in the body, ordered by offset
+    uint16_t        slotcount;
 } macro_t;
 
+// Result of a macro expansion, for a macro / substitutions / adl mode / cpu combination
+#define MACROCACHE_SIZED     0x01                 // size known from the first pass
+#define MACROCACHE_ENCODED   0x02                 // output bytes known
+#define MACROCACHE_NOSIZE    0x04                 // first pass expansion depends on assembler state
+#define MACROCACHE_NOENCODE  0x08                 // output depends on assembler state
+
+typedef struct {
+    macro_t*        macro;
+    char*           substitutions;                // all substitutions, each followed by a newline
+    uint16_t        hash;
+    bool            adlmode;
+    uint8_t         cputype;
+    uint8_t         flags;
+    uint24_t        size;                         // address space of the expansion
+    uint8_t*        bytes;                        // output bytes of the expansion
+    void*           next;
+} macrocache_t;
+
 typedef struct {
     char*           name;
     uint8_t         type;                       // EZ80 / Assembler / MACRO
@@ -230,6 +239,112 @@ typedef struct {
     void*           next;
 } instruction_t;
 
+// Operand signature of a parsed line, with the operandlist entry it matched
+typedef struct {
+    instruction_t*  instruction;
+    uint24_t        regA;
+    uint24_t        regB;
+    uint8_t         modes;                        // addressmode A in the upper nibble, B in the lower
+    bool            cc;
+    operandlist_t*  operands;                     // NULL for an unused entry
+} operandcache_t;
+
+// Per-line results from the first pass, re-used during the next pass
+typedef struct {
+    instruction_t*  instruction;                  // looked-up mnemonic / directive / macro
+    operandlist_t*  operands;                     // matching operandlist entry, NULL if not (yet) matched
+} lineinfo_t;
+
+typedef struct contentitem {
+    // Static items
+    char*           name;                         // name of the file
+    unsigned int    size;                         // size of the file
+    char*           buffer;                       // pointer to 1) full file content OR 2) partial content during minimal buffering
+    FILE*           fh;                           // filehandle
+    void*           next;
+    // Items changed during processing
+    char*           readptr;
+    uint24_t        filepos;                      // The current VIRTUAL position in a buffered file to read from. Needed for fseek purposes        
+    uint16_t        lastreadlength;
+    uint16_t        currentlinenumber;
+    char            labelscope[MAXNAMELENGTH+1];
+    uint8_t         inConditionalSection;
+    unsigned int    bytesinbuffer;                // only used during minimal input buffering
+    lineinfo_t*     lineinfo;                     // first pass results per line, indexed by line number. NULL when unavailable
+    uint16_t        linecount;
+    bool            mapped;                       // buffer is a read-only mapping of the file
+    bool            replayed;                     // definitions were replayed from the include cache, the file isn't processed
+} contentitem_t;
+
+// File content provided in memory, used instead of the file with the same name
+typedef struct {
+    char*           name;
+    const char*     buffer;
+    uint24_t        size;
+    void*           next;
+} memorysource_t;
+
+// File mapping kept between assemblies in server mode, valid while the file doesn't change
+typedef struct {
+    char*           path;                         // resolved path of the file
+    uint64_t        inode;
+    int64_t         mtime;                        // modification time, in nanoseconds where available
+    uint24_t        size;
+    char*           buffer;
+    void*           next;
+} contentcache_t;
+
+// Assembler state at the start of an include file that its definitions can depend on,
+// part of the key of its include cache entry
+typedef struct {
+    uint64_t        contenthash;
+    uint32_t        size;
+    uint32_t        address;
+    uint32_t        relocateBaseAddress;
+    uint32_t        relocateOutputBaseAddress;
+    uint8_t         cputype;
+    uint8_t         adlmode;
+    uint8_t         relocate;
+} includestate_t;
+
+// Input and output filename of a job in batch mode
+typedef struct {
+    char            input[FILENAMEMAXLENGTH + 1];
+    char            output[FILENAMEMAXLENGTH + 1];
+    int             pid;                          // worker process assembling this job
+    bool            failed;
+} batchjob_t;
+
+// File loaded by the last assembly in watch mode, by its directory watch and name within that directory
+typedef struct {
+    int             wd;
+    char            name[FILENAMEMAXLENGTH + 1];
+} watchfile_t;
+
+// Source line that needs to be assembled again at the end of single pass assembly
+typedef struct {
+    char*           line;                         // start of the line in the persistent file buffer or macro body
+    contentitem_t*  ci;
+    uint16_t        linenumber;
+    char*           labelscope;
+    macro_t*        macro;                        // NULL if the line isn't expanded from a macro
+    char**          substitutions;                // copy of the macro arguments for this expansion
+    uint24_t        expandID;
+    unsigned int    macrolinenumber;
+    uint8_t         macrolevel;
+    uint8_t         contentlevel;
+    uint24_t        address;
+    uint24_t        outputposition;               // position of the first byte of this line in the output file
+    uint24_t        anonymouslabels;              // number of anonymous labels defined before this line
+    bool            adlmode;
+    uint8_t         cputype;
+    uint8_t         fillbyte;
+    bool            relocate;
+    uint24_t        relocateBaseAddress;
+    uint24_t        relocateOutputBaseAddress;
+    void*           next;
+} fixup_t;
+
 typedef struct {
     instruction_t*  current_instruction;
     macro_t*        current_macro;
@@ -244,9 +359,18 @@ typedef struct {
     uint16_t size;      // byte size of the assembler-command output in db/defb/dw/defw
 } tokenline_t;
 
+// Bump-pointer memory region, allocated in blocks and released at once
+typedef struct {
+    void*           blocks;                       // linked list of allocated blocks
+    char*           ptr;                          // next free byte in the current block
+    uint24_t        remaining;                    // free bytes in the current block
+    uint24_t*       bytecounter;                  // total size of all blocks
+} arena_t;
+
 typedef struct {
     char*           name;
     bool            local;
+    uint16_t        hash;
     void*           next;
     uint24_t        address;
 } label_t;
@@ -257,6 +381,57 @@ typedef struct {
     uint24_t        address;
 } anonymouslabel_t;
 
+typedef enum {
+    TERM_VALUE,                                   // number or literal, converted during compilation
+    TERM_LABEL,                                   // global label
+    TERM_FORWARD,                                 // global label, undefined during compilation
+    TERM_NAME,                                    // local / anonymous label or '$', resolved at each evaluation
+    TERM_EXPRESSION,                              // bracketed sub-expression
+} termtype_t;
+
+// One value in a compiled expression, with the operators applied to it
+typedef struct {
+    uint8_t         type;
+    char            operator;
+    char            unaryoperator;                // not used on a TERM_VALUE, the value already has it applied
+    uint8_t         length;                       // name length
+    int32_t         value;
+    label_t*        label;
+    char*           name;
+    void*           expression;
+} expressionterm_t;
+
+// Expression text compiled to its list of terms, evaluated from left to right
+typedef struct {
+    char*             text;
+    uint16_t          hash;
+    uint8_t           termcount;
+    expressionterm_t* terms;
+    void*             next;
+} expression_t;
+
+typedef enum {
+    LISTRECORD_LINE,                              // start of a source line, followed by its text
+    LISTRECORD_ENDLINE,
+    LISTRECORD_BYTES,                             // emitted bytes, followed by the bytes
+    LISTRECORD_FILL,                              // run of a single emitted value
+    LISTRECORD_DSLINES,                           // pending ds space
+    LISTRECORD_COMMENT,                           // followed by the comment text
+} listrecordtype_t;
+
+// Listing event in the emit log, with the assembler state needed to format it later
+typedef struct {
+    uint8_t         type;
+    uint8_t         contentlevel;
+    uint8_t         macrolevel;
+    bool            inmacro;
+    uint8_t         fill;
+    uint24_t        value;                        // address of a line, number of bytes otherwise
+    uint24_t        linenumber;
+    uint24_t        macrolinenumber;
+    uint24_t        length;                       // size of the data following the record
+} listrecord_t;
+
 // Token type that points to the (changed) underlying data string
 typedef struct {
     char*           start;
@@ -361,6 +536,14 @@ typedef enum {
     NUMBER,
 } getValueState_t;
 
+// Line types recognised by the false conditional section scanner
+typedef enum {
+    SKIP_NONE,
+    SKIP_CONDITIONAL,
+    SKIP_MACRO,
+    SKIP_ENDMACRO,
+} skipline_t;
+
 // Errors
 typedef enum {
     ERROR_OPENINGBRACKET,
@@ -451,7 +634,8 @@ typedef enum {
     ERROR_NESTEDRELOCATE,
     ERROR_MISSINGRELOCATE,
     ERROR_UNSUPPORTED_CPU,
-    ERROR_SYNTAX
+    ERROR_SYNTAX,
+    ERROR_INCBINRANGE
 } errormessage_t;
 
 #endif
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+#include "defines.h"
+#include "globals.h"
+#include "utils.h"
+#include "label.h"
+#include "arena.h"
+#include "macro.h"
+#include "expression.h"
+#include "includecache.h"
+
+// Total allocated memory for compiled expressions
+uint24_t expressionmemsize;
+arena_t  expressionarena;
+uint24_t expressionCounter;
+
+// Compiled expressions, by hash of their text
+expression_t *expressionTable[EXPRESSION_HASHTABLESIZE];
+
+void initExpressions(void) {
+    initArena(&expressionarena, &expressionmemsize);
+    expressionCounter = 0;
+    memset(expressionTable, 0, sizeof(expressionTable));
+}
+
+expression_t *findExpression(const char *text, uint16_t hash) {
+    expression_t *try;
+
+    try = expressionTable[hash & (EXPRESSION_HASHTABLESIZE - 1)];
+    while(try) {
+        if((try->hash == hash) && (strcmp(try->text, text) == 0)) return try;
+        try = try->next;
+    }
+    return NULL;
+}
+
+// Store a copy of the compiled terms under the expression text, NULL if out of memory
+expression_t *storeExpression(const char *text, uint16_t hash, const expressionterm_t *terms, uint8_t termcount) {
+    expression_t *e;
+    uint8_t i;
+
+    e = (expression_t *)arenaAllocate(&expressionarena, sizeof(expression_t));
+    if(e == NULL) return NULL;
+    e->text = arenaString(&expressionarena, text);
+    e->terms = (expressionterm_t *)arenaAllocate(&expressionarena, termcount * sizeof(expressionterm_t));
+    if((e->text == NULL) || (e->terms == NULL)) return NULL;
+    memcpy(e->terms, terms, termcount * sizeof(expressionterm_t));
+    for(i = 0; i < termcount; i++) {
+        if(terms[i].name) { // names point to a temporary buffer
+            e->terms[i].name = arenaString(&expressionarena, terms[i].name);
+            if(e->terms[i].name == NULL) return NULL;
+        }
+    }
+    e->hash = hash;
+    e->termcount = termcount;
+    e->next = expressionTable[hash & (EXPRESSION_HASHTABLESIZE - 1)];
+    expressionTable[hash & (EXPRESSION_HASHTABLESIZE - 1)] = e;
+    expressionCounter++;
+    return e;
+}
+
+int32_t applyOperator(int32_t total, char operator, int32_t value) {
+    switch(operator) {
+        case 0:
+        case '+': return total + value;
+        case '-': return total - value;
+        case '*': return total * value;
+        case '<': return total << value;
+        case '>': return total >> value;
+        case '&': return total & value;
+        case '|': return total | value;
+        case '^': return total ^ value;
+        case '~': return total + ~value;
+        case '/': return total / value;
+        default:
+            error(message[ERROR_OPERATOR],"%c",operator);
+            return 0;
+    }
+}
+
+// Same result as getExpressionValue on the text, without parsing it again
+int32_t evaluateExpression(expression_t *e, requiredResult_t requiredPass) {
+    expressionterm_t *term;
+    label_t *lbl;
+    int32_t value = 0;
+    int32_t total = 0;
+    uint8_t i;
+
+    for(i = 0, term = e->terms; i < e->termcount; i++, term++) {
+        switch(term->type) {
+            case TERM_VALUE:
+                value = term->value;
+                break;
+            case TERM_LABEL:
+                macroExpansionPure = false;
+                if(includerecording) includeCacheLabelUsed(term->label);
+                value = term->label->address;
+                break;
+            case TERM_FORWARD:
+                lbl = findGlobalLabel(term->name);
+                if(lbl) { // defined since compilation
+                    term->type = TERM_LABEL;
+                    term->label = lbl;
+                    value = lbl->address;
+                }
+                else value = resolveNumber(term->name, term->length, requiredPass);
+                break;
+            case TERM_NAME:
+                value = resolveNumber(term->name, term->length, requiredPass);
+                break;
+            case TERM_EXPRESSION:
+                value = evaluateExpression(term->expression, requiredPass);
+                break;
+        }
+        if(term->unaryoperator == '-') value = -value;
+        if(term->unaryoperator == '~') value = ~value;
+        total = applyOperator(total, term->operator, value);
+    }
+    return forwardreference?0:total;
+}
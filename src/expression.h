@@ -0,0 +1,15 @@
+#ifndef EXPRESSION_H
+#define EXPRESSION_H
+
+#include "defines.h"
+
+extern uint24_t expressionmemsize;
+extern uint24_t expressionCounter;
+
+void           initExpressions(void);
+expression_t * findExpression(const char *text, uint16_t hash);
+expression_t * storeExpression(const char *text, uint16_t hash, const expressionterm_t *terms, uint8_t termcount);
+int32_t        evaluateExpression(expression_t *e, requiredResult_t requiredPass);
+int32_t        applyOperator(int32_t total, char operator, int32_t value);
+
+#endif // EXPRESSION_H
@@ -0,0 +1,197 @@
+#ifndef AGONDEV
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef UNIX
+#include <pthread.h>
+#endif
+#include "config.h"
+#include "defines.h"
+#include "globals.h"
+#include "io.h"
+#include "assemble.h"
+#include "ez80asm.h"
+
+// Options, sources and results of an assembly through the library interface
+struct asm_context {
+    // Options, asmCreateContext sets the command line defaults
+    uint24_t        start_address;
+    uint8_t         fillbyte;
+    bool            adlmode;
+    bool            ignore_truncation_warnings;
+    bool            singlepass;
+    bool            listing;                      // produce a listing in listingtext
+    // Files read from memory instead of from disk
+    memorysource_t* sources;
+    // Results, allocated during asmAssemble
+    uint8_t*        output;
+    uint24_t        outputsize;
+    char*           listingtext;
+    uint24_t        listingsize;
+    char*           messages;
+    uint24_t        messagesize;
+    uint16_t        errorcount;
+};
+
+#ifdef UNIX
+// The assembler state is global, an assembly holds it until it is done
+// This serializes assemblies process-wide, it doesn't make asmAssemble re-entrant
+pthread_mutex_t _assemblerlock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+void _asmFreeResults(asm_context_t *ctx) {
+    free(ctx->output);
+    free(ctx->listingtext);
+    free(ctx->messages);
+    ctx->output = NULL;
+    ctx->outputsize = 0;
+    ctx->listingtext = NULL;
+    ctx->listingsize = 0;
+    ctx->messages = NULL;
+    ctx->messagesize = 0;
+    ctx->errorcount = 0;
+}
+
+asm_context_t *asmCreateContext(void) {
+    asm_context_t *ctx;
+
+    ctx = (asm_context_t *)malloc(sizeof(asm_context_t));
+    if(ctx == NULL) return NULL;
+    memset(ctx, 0, sizeof(asm_context_t));
+    ctx->start_address = START_ADDRESS;
+    ctx->fillbyte = FILLBYTE;
+    ctx->adlmode = ADLMODE_START;
+    return ctx;
+}
+
+void asmFreeContext(asm_context_t *ctx) {
+    memorysource_t *ms, *next;
+
+    if(ctx == NULL) return;
+    _asmFreeResults(ctx);
+    for(ms = ctx->sources; ms; ms = next) {
+        next = ms->next;
+        free(ms->name);
+        free(ms);
+    }
+    free(ctx);
+}
+
+void asmSetStartAddress(asm_context_t *ctx, uint32_t address) {
+    ctx->start_address = address & 0xFFFFFF;
+}
+
+void asmSetFillbyte(asm_context_t *ctx, uint8_t fillbyte) {
+    ctx->fillbyte = fillbyte;
+}
+
+void asmSetADLMode(asm_context_t *ctx, bool adlmode) {
+    ctx->adlmode = adlmode;
+}
+
+void asmSetSinglePass(asm_context_t *ctx, bool singlepass) {
+    ctx->singlepass = singlepass;
+}
+
+void asmSetListing(asm_context_t *ctx, bool listing) {
+    ctx->listing = listing;
+}
+
+void asmSetIgnoreTruncationWarnings(asm_context_t *ctx, bool ignore) {
+    ctx->ignore_truncation_warnings = ignore;
+}
+
+// Provide the content of a source or binary file in memory
+bool asmAddSource(asm_context_t *ctx, const char *name, const char *buffer, size_t size) {
+    memorysource_t *ms;
+
+    if(size > 0xFFFFFF) return false;
+    ms = (memorysource_t *)malloc(sizeof(memorysource_t));
+    if(ms == NULL) return false;
+    ms->name = (char *)malloc(strlen(name) + 1);
+    if(ms->name == NULL) {
+        free(ms);
+        return false;
+    }
+    strcpy(ms->name, name);
+    ms->buffer = buffer;
+    ms->size = size;
+    ms->next = ctx->sources;
+    ctx->sources = ms;
+    return true;
+}
+
+// Assemble a file, read from the memory sources when available and otherwise from disk
+// The output, listing and messages are placed in the context
+bool asmAssemble(asm_context_t *ctx, const char *filename) {
+    FILE *messages;
+
+    _asmFreeResults(ctx);
+    messages = tmpfile();
+    if(messages == NULL) return false;
+
+    #ifdef UNIX
+    pthread_mutex_lock(&_assemblerlock);
+    #endif
+    messageoutput = messages;
+    fillbyte = ctx->fillbyte;
+    adlmode = ctx->adlmode;
+    start_address = ctx->start_address;
+    ignore_truncation_warnings = ctx->ignore_truncation_warnings;
+    singlepass = ctx->singlepass;
+    list_enabled = ctx->listing;
+    consolelist_enabled = false;
+    listelision = 0;
+    exportsymbols = false;
+    displaystatistics = false;
+    coloroutput = false;
+    completefilebuffering = true;
+    cachedirectory[0] = 0;
+    memorysources = ctx->sources;
+    memoryoutput = true;
+    errorcount = 0;
+
+    if(ioInit(filename, NULL)) {
+        initAssembler();
+        assemble(filename);
+        ioFlush();
+        if(errorcount == 0) {
+            ctx->output = (uint8_t *)ioReadStream(filehandle[FILE_OUTPUT], &ctx->outputsize);
+            if(list_enabled) ctx->listingtext = ioReadStream(filehandle[FILE_LISTING], &ctx->listingsize);
+        }
+        ioClose();
+    }
+    ctx->errorcount = errorcount;
+    ctx->messages = ioReadStream(messages, &ctx->messagesize);
+    fclose(messages);
+
+    messageoutput = stdout;
+    memorysources = NULL;
+    memoryoutput = false;
+    #ifdef UNIX
+    pthread_mutex_unlock(&_assemblerlock);
+    #endif
+    return (ctx->errorcount == 0);
+}
+
+const uint8_t *asmOutput(const asm_context_t *ctx, size_t *size) {
+    if(size) *size = ctx->outputsize;
+    return ctx->output;
+}
+
+const char *asmListing(const asm_context_t *ctx, size_t *size) {
+    if(size) *size = ctx->listingsize;
+    return ctx->listingtext;
+}
+
+const char *asmMessages(const asm_context_t *ctx, size_t *size) {
+    if(size) *size = ctx->messagesize;
+    return ctx->messages;
+}
+
+unsigned int asmErrorCount(const asm_context_t *ctx) {
+    return ctx->errorcount;
+}
+
+#endif // AGONDEV
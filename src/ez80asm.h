@@ -0,0 +1,39 @@
+#ifndef EZ80ASM_H
+#define EZ80ASM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Library interface, assembling from memory to memory
+// Each context holds its own options, sources and results, but the assembler itself
+// keeps its state in process-wide globals:
+// - Assemblies are serialized process-wide. asmAssemble holds a global lock on Unix builds,
+//   so calls from different threads wait for each other and never run in parallel.
+//   Other builds have no lock and need to call asmAssemble from a single thread
+// - asmAssemble is not re-entrant. Don't call it from a signal handler, or from anything
+//   that can interrupt an assembly in progress
+// - A single context isn't safe to use from several threads at the same time
+typedef struct asm_context asm_context_t;
+
+asm_context_t * asmCreateContext(void);                    // with the command line defaults, NULL when out of memory
+void            asmFreeContext(asm_context_t *ctx);        // releases the results and the provided sources
+
+void            asmSetStartAddress(asm_context_t *ctx, uint32_t address);
+void            asmSetFillbyte(asm_context_t *ctx, uint8_t fillbyte);
+void            asmSetADLMode(asm_context_t *ctx, bool adlmode);
+void            asmSetSinglePass(asm_context_t *ctx, bool singlepass);
+void            asmSetListing(asm_context_t *ctx, bool listing);
+void            asmSetIgnoreTruncationWarnings(asm_context_t *ctx, bool ignore);
+
+// The buffer isn't copied and needs to stay available until the context is freed
+bool            asmAddSource(asm_context_t *ctx, const char *name, const char *buffer, size_t size);
+bool            asmAssemble(asm_context_t *ctx, const char *filename);
+
+// Results of the last assembly, owned by the context
+const uint8_t * asmOutput(const asm_context_t *ctx, size_t *size);
+const char *    asmListing(const asm_context_t *ctx, size_t *size);    // NULL without a listing
+const char *    asmMessages(const asm_context_t *ctx, size_t *size);   // errors, warnings and progress messages
+unsigned int    asmErrorCount(const asm_context_t *ctx);
+
+#endif // EZ80ASM_H
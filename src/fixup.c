@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+#include "defines.h"
+#include "globals.h"
+#include "utils.h"
+#include "label.h"
+#include "io.h"
+#include "assemble.h"
+#include "macro.h"
+#include "console.h"
+#include "arena.h"
+#include "fixup.h"
+
+// Total allocated memory for fixups
+uint24_t fixupmemsize;
+arena_t  fixuparena;
+uint24_t fixupCounter;
+
+// Fixup list, in order of the output
+fixup_t *_fixupFirst;
+fixup_t *_fixupLast;
+
+// State at the start of the line currently being processed
+fixup_t _lineState;
+char    _lineScope[MAXNAMELENGTH+1];
+
+void initFixups(void) {
+    initArena(&fixuparena, &fixupmemsize);
+    fixupCounter = 0;
+    _fixupFirst = NULL;
+    _fixupLast = NULL;
+}
+
+// Store the assembler state at the start of a line, in case the line contains a forward reference
+void fixupLineStart(char *line) {
+    _lineState.line = line;
+    _lineState.ci = currentcontentitem;
+    _lineState.linenumber = currentcontentitem->currentlinenumber;
+    _lineState.macro = currentExpandedMacro;
+    _lineState.expandID = currentExpandedMacro?currentExpandedMacro->currentExpandID:0;
+    _lineState.macrolinenumber = macrolinenumber;
+    _lineState.macrolevel = macrolevel;
+    _lineState.contentlevel = contentlevel;
+    _lineState.address = address;
+    _lineState.outputposition = ioGetOutputPosition() + remaining_dsspaces; // pending space is output before the first byte of this line
+    _lineState.anonymouslabels = getAnonymousLabelCount();
+    _lineState.adlmode = adlmode;
+    _lineState.cputype = cputype;
+    _lineState.fillbyte = fillbyte;
+    _lineState.relocate = relocate;
+    _lineState.relocateBaseAddress = relocateBaseAddress;
+    _lineState.relocateOutputBaseAddress = relocateOutputBaseAddress;
+    strcpy(_lineScope, currentcontentitem->labelscope); // a global label on this line changes the scope
+    forwardreference = false;
+}
+
+// Copy the current macro arguments, or share them with the previous fixup from the same expansion
+char **_copySubstitutions(void) {
+    macro_t *m = _lineState.macro;
+    char **substitutions;
+
+    if(m->argcount == 0) return NULL;
+    if(_fixupLast && (_fixupLast->macro == m) && (_fixupLast->expandID == _lineState.expandID)) {
+        return _fixupLast->substitutions;
+    }
+    substitutions = (char **)arenaAllocate(&fixuparena, m->argcount * sizeof(char *));
+    if(substitutions == NULL) return NULL;
+    for(uint8_t i = 0; i < m->argcount; i++) {
+        substitutions[i] = arenaString(&fixuparena, m->substitutions[i]);
+        if(substitutions[i] == NULL) return NULL;
+    }
+    return substitutions;
+}
+
+// Record the current line for re-assembly, if it contained a forward reference
+void fixupLineEnd(void) {
+    fixup_t *f;
+
+    if(!forwardreference) return;
+    forwardreference = false;
+
+    f = (fixup_t *)arenaAllocate(&fixuparena, sizeof(fixup_t));
+    if(f == NULL) return;
+    *f = _lineState;
+    f->labelscope = arenaString(&fixuparena, _lineScope);
+    if(f->labelscope == NULL) return;
+    f->substitutions = NULL;
+    if(f->macro) {
+        f->substitutions = _copySubstitutions();
+        if(f->macro->argcount && (f->substitutions == NULL)) return;
+    }
+    f->next = NULL;
+
+    if(_fixupLast) _fixupLast->next = f;
+    else _fixupFirst = f;
+    _fixupLast = f;
+    fixupCounter++;
+}
+
+void _restoreState(fixup_t *f) {
+    currentcontentitem = f->ci;
+    f->ci->currentlinenumber = f->linenumber;
+    strcpy(f->ci->labelscope, f->labelscope);
+    contentlevel = f->contentlevel;
+    address = f->address;
+    adlmode = f->adlmode;
+    cputype = f->cputype;
+    fillbyte = f->fillbyte;
+    relocate = f->relocate;
+    relocateBaseAddress = f->relocateBaseAddress;
+    relocateOutputBaseAddress = f->relocateOutputBaseAddress;
+    remaining_dsspaces = 0;
+    inConditionalSection = CONDITIONSTATE_NORMAL;
+    seekAnonymousLabel(f->anonymouslabels);
+    ioSeekOutput(f->outputposition);
+
+    if(f->macro) {
+        for(uint8_t i = 0; i < f->macro->argcount; i++) f->macro->substitutions[i] = f->substitutions[i];
+        f->macro->currentExpandID = f->expandID;
+        currentExpandedMacro = f->macro;
+        macrolinenumber = f->macrolinenumber;
+        macrolevel = f->macrolevel;
+        currentlineinfo = NULL;
+    }
+    else {
+        currentExpandedMacro = NULL;
+        macrolevel = 0;
+        currentlineinfo = (f->linenumber <= f->ci->linecount) ? &f->ci->lineinfo[f->linenumber] : NULL;
+    }
+}
+
+// Assemble all recorded lines again, now that all labels are known,
+// and patch their output at the recorded position in the output file
+void processFixups(void) {
+    char line[LINEMAX+1];
+    char errorline[LINEMAX+1];
+    char *ptr;
+    fixup_t *f;
+
+    pass = ENDPASS;
+    issue_warning = false;
+
+    for(f = _fixupFirst; f; f = f->next) {
+        _restoreState(f);
+        if(f->macro) {
+            ptr = f->line;
+            getnextMacroLine(&ptr, line);
+            setMacroLine(f->macro, f->line, line);
+        }
+        else { // re-read from the file content, the buffer might not be zero-terminated
+            seekContentInput(f->ci, f->line - f->ci->buffer);
+            getnextContentLine(line, f->ci);
+        }
+        strcpy(errorline, line); // parseLine tokenizes the line in place
+
+        parseLine(line);
+        processInstructions();
+
+        if(errorcount || issue_warning) {
+            trimRight(errorline);
+            if(f->macro) {
+                colorPrintf(YELLOW, "%s\n", macroExpandArg(macro_expansionbuffer, errorline, f->macro));
+            }
+            else colorPrintf(YELLOW, "%s\n", errorline);
+            issue_warning = false;
+            if(errorcount) break;
+        }
+    }
+    currentExpandedMacro = NULL;
+    remaining_dsspaces = 0;
+}
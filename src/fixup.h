@@ -0,0 +1,14 @@
+#ifndef FIXUP_H
+#define FIXUP_H
+
+#include "defines.h"
+
+extern uint24_t fixupmemsize;
+extern uint24_t fixupCounter;
+
+void initFixups(void);
+void fixupLineStart(char *line);
+void fixupLineEnd(void);
+void processFixups(void);
+
+#endif // FIXUP_H
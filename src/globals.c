@@ -14,6 +14,7 @@ uint8_t contentlevel;
 uint8_t errorreportlevel;
 uint8_t maxstackdepth;
 contentitem_t *currentcontentitem;
+lineinfo_t *currentlineinfo;
 uint16_t sourcefilecount;
 uint16_t binfilecount;
 uint24_t filecontentsize;
@@ -30,14 +31,19 @@ bool adlmode;
 bool listing;                // list_enabled || consolelist_enabled
 bool list_enabled;
 bool consolelist_enabled;
+uint24_t listelision;        // rows listed at the start and end of long data blocks, 0 lists everything
 uint8_t fillbyte;
 uint24_t start_address;
 bool coloroutput;
+FILE *messageoutput;         // errors, warnings and progress messages
 unsigned int labelcollisions;
 bool ignore_truncation_warnings;
 bool issue_warning;
 uint24_t remaining_dsspaces;
 bool exportsymbols, displaystatistics;
+bool singlepass;
+char cachedirectory[FILENAMEMAXLENGTH + 1]; // include cache, not used when empty
+bool forwardreference;
 
 tokenline_t currentline;
 
@@ -136,5 +142,6 @@ char *message[] = {
     "Nested relocate not allowed",
     "Missing RELOCATE directive",
     "Unsupported CPU type",
-    "Syntax error"
+    "Syntax error",
+    "Offset/length outside of incbin file"
 };
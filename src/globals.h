@@ -15,6 +15,7 @@ extern uint8_t contentlevel;
 extern uint8_t errorreportlevel;
 extern uint8_t maxstackdepth;
 extern contentitem_t *currentcontentitem;
+extern lineinfo_t *currentlineinfo;
 extern uint16_t sourcefilecount;
 extern uint16_t binfilecount;
 extern uint24_t filecontentsize;
@@ -32,14 +33,19 @@ extern tokenline_t currentline;
 extern bool listing;                // list_enabled || consolelist_enabled
 extern bool list_enabled;
 extern bool consolelist_enabled;
+extern uint24_t listelision;        // rows listed at the start and end of long data blocks, 0 lists everything
 extern uint8_t fillbyte;
 extern uint24_t start_address;
 extern bool coloroutput;
+extern FILE *messageoutput;         // errors, warnings and progress messages
 extern unsigned int labelcollisions;
 extern bool ignore_truncation_warnings;
 extern bool issue_warning;
 extern uint24_t remaining_dsspaces;
 extern bool exportsymbols, displaystatistics;
+extern bool singlepass;
+extern char cachedirectory[FILENAMEMAXLENGTH + 1]; // include cache, not used when empty
+extern bool forwardreference;
 
 // Global parsed results
 extern uint8_t suffix;      // per-instruction suffix code
@@ -21,24 +21,45 @@ static uint8_t pearson[256] = {
      51,  65,  28, 144, 254, 221,  93, 189, 194, 139, 112,  43,  71, 109, 184, 209
 };
 
-/*
-uint16_t hash(char *key) {
-    uint16_t h;
-    unsigned char h1, h2;
+// Two Pearson hashes with a different start value, combined into 16 bits
+uint16_t hash16(const char *key) {
+    uint8_t h1, h2;
     
     if (*key == 0) return 0;
-    h1 = *key; h2 = *key + 1;
+    h1 = pearson[(uint8_t)*key]; h2 = pearson[(uint8_t)(*key + 1)];
     key++;
     while (*key) {
-        h1 = pearson[h1 ^ *key];
-        h2 = pearson[h2 ^ *key];
+        h1 = pearson[h1 ^ (uint8_t)*key];
+        h2 = pearson[h2 ^ (uint8_t)*key];
         key++;
     }
+    return ((uint16_t)h1 << 8) | h2;
+}
 
-    h = ((uint16_t)h1 << 8)|(uint16_t)h2;
-    return h;
+// hash16 over the lowercase key, with a different start value for the lower byte.
+// The lowercase key is copied to 'lowercase' (at most size-1 characters)
+uint16_t lowercaseHash16(const char *key, char *lowercase, uint8_t size, uint8_t seed) {
+    uint8_t h1, h2;
+    char c;
+    
+    *lowercase = 0;
+    if (*key == 0) return 0;
+    c = tolower(*key++);
+    h1 = pearson[(uint8_t)c]; h2 = pearson[(uint8_t)(c + seed)];
+    *lowercase++ = c; size--;
+    while (*key) {
+        c = tolower(*key++);
+        h1 = pearson[h1 ^ (uint8_t)c];
+        h2 = pearson[h2 ^ (uint8_t)c];
+        if(size > 1) {
+            *lowercase++ = c;
+            size--;
+        }
+    }
+    *lowercase = 0;
+    return ((uint16_t)h1 << 8) | h2;
 }
-*/
+
 uint8_t hash256(const char *key) {
     uint8_t h = 0;
     
@@ -1,7 +1,8 @@
 #ifndef HASH_H
 #define HASH_H
 
-//uint16_t hash(char *key); // returns hash as 16bit unsigned int
+uint16_t hash16(const char *key); // returns hash as 16bit unsigned int
+uint16_t lowercaseHash16(const char *key, char *lowercase, uint8_t size, uint8_t seed);
 uint8_t hash256(const char *key);
 uint8_t lowercaseHash256(const char *key);
 
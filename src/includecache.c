@@ -0,0 +1,449 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#ifdef UNIX
+#include <unistd.h>
+#endif
+#include "config.h"
+#include "defines.h"
+#include "globals.h"
+#include "utils.h"
+#include "label.h"
+#include "macro.h"
+#include "io.h"
+#include "includecache.h"
+
+// The include cache stores the label and macro definitions of an include file, made during
+// the first pass. A later assembly replays these instead of processing the file, when the file
+// content, its entry state and the values of all labels it used from outside are the same.
+// Only files that define labels and macros are cached; a file that outputs bytes, includes
+// other files, expands macros or changes any other assembler state is always processed
+//
+// Entry layout, in native byte order:
+// magic, includestate_t, name, counts, used labels, defined labels, macros
+
+#define INCLUDECACHE_MAGIC "ez80inc2"
+
+bool     includerecording;                // the current include file is being recorded
+uint24_t includeCacheHits;
+uint24_t includeCacheMisses;
+
+// Recording of the current include file
+contentitem_t *_recordci;
+uint8_t        _recordlevel;
+bool           _cacheable;
+includestate_t _entrystate;
+uint24_t       _entryoutputposition;
+uint8_t        _entryfillbyte;
+uint24_t       _entrybinfilecount;
+uint24_t       _entryexpandid;
+uint24_t       _entryanonymouslabels;
+
+// Definitions and uses, in order
+label_t **     _defined;
+uint24_t       _definedcount;
+uint24_t       _definedcapacity;
+uint16_t *     _definedlines;             // line of each defined label in the file, for error reports
+label_t **     _used;
+uint24_t       _usedcount;
+uint24_t       _usedcapacity;
+macro_t **     _macros;
+uint24_t       _macrocount;
+uint24_t       _macrocapacity;
+
+void initIncludeCache(void) {
+    includerecording = false;
+    includeCacheHits = 0;
+    includeCacheMisses = 0;
+    _recordci = NULL;
+}
+
+bool includeCacheEnabled(void) {
+    // The listing needs every line of every file, the minimum memory configuration has no file content
+    return (cachedirectory[0] != 0) && completefilebuffering && !listing;
+}
+
+uint64_t _fnv1a(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *ptr = (const uint8_t *)data;
+
+    while(size--) {
+        hash ^= *ptr++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+void _entryState(contentitem_t *ci, includestate_t *state) {
+    memset(state, 0, sizeof(includestate_t)); // the state is hashed and compared as bytes
+    state->contenthash = _fnv1a(0xcbf29ce484222325ULL, ci->buffer, ci->size);
+    state->size = ci->size;
+    state->address = address;
+    state->relocateBaseAddress = relocateBaseAddress;
+    state->relocateOutputBaseAddress = relocateOutputBaseAddress;
+    state->cputype = cputype;
+    state->adlmode = adlmode;
+    state->relocate = relocate;
+}
+
+// Local labels carry the name of the file, so the name is part of the key
+bool _entryPath(char *path, size_t size, contentitem_t *ci, const includestate_t *state) {
+    uint64_t key;
+    int length;
+
+    key = _fnv1a(0xcbf29ce484222325ULL, state, sizeof(includestate_t));
+    key = _fnv1a(key, ci->name, strlen(ci->name) + 1);
+    length = snprintf(path, size, "%s/%08lx%08lx.cache", cachedirectory, (unsigned long)(key >> 32), (unsigned long)(key & 0xffffffff));
+    return (length > 0) && ((size_t)length < size);
+}
+
+bool _append(void ***list, uint24_t *count, uint24_t *capacity, void *item) {
+    void **table;
+    uint24_t size;
+
+    if(*count == *capacity) {
+        size = *capacity ? *capacity * 2 : 64;
+        table = (void **)realloc(*list, size * sizeof(void *));
+        if(table == NULL) return false;
+        *list = table;
+        *capacity = size;
+    }
+    (*list)[(*count)++] = item;
+    return true;
+}
+
+int _comparePointers(const void *a, const void *b) {
+    uintptr_t pa = (uintptr_t)*(void * const *)a;
+    uintptr_t pb = (uintptr_t)*(void * const *)b;
+
+    return (pa > pb) - (pa < pb);
+}
+
+// Reading back an entry, all reads are checked against the end of the entry
+typedef struct {
+    const uint8_t *ptr;
+    const uint8_t *end;
+} _cursor_t;
+
+bool _read(_cursor_t *c, void *dst, size_t size) {
+    if((size_t)(c->end - c->ptr) < size) return false;
+    memcpy(dst, c->ptr, size);
+    c->ptr += size;
+    return true;
+}
+
+// Read a name with its length byte, into a zero-terminated buffer of at least 256 bytes
+bool _readName(_cursor_t *c, char *name) {
+    uint8_t length;
+
+    if(!_read(c, &length, 1) || !_read(c, name, length)) return false;
+    name[length] = 0;
+    return true;
+}
+
+void _writeName(FILE *fh, const char *name) {
+    uint8_t length = strlen(name);
+
+    fwrite(&length, 1, 1, fh);
+    fwrite(name, 1, length, fh);
+}
+
+// Check all labels the file used from outside, with the current values
+bool _validDependencies(_cursor_t *c, uint32_t count) {
+    char name[256];
+    uint32_t value;
+    label_t *lbl;
+
+    while(count--) {
+        if(!_read(c, &value, sizeof(value)) || !_readName(c, name)) return false;
+        lbl = findGlobalLabel(name);
+        if((lbl == NULL) || (lbl->address != value)) return false;
+    }
+    return true;
+}
+
+// Check the layout of all definitions, before any of them is applied
+bool _validDefinitions(_cursor_t c, uint32_t labels, uint32_t macros) {
+    char name[256];
+    uint32_t value, length;
+    uint16_t line;
+    uint8_t argcount, local;
+
+    while(labels--) {
+        if(!_read(&c, &value, sizeof(value)) || !_read(&c, &line, sizeof(line)) || !_read(&c, &local, 1) || !_readName(&c, name)) return false;
+    }
+    while(macros--) {
+        if(!_read(&c, &argcount, 1) || !_read(&c, &line, sizeof(line)) || !_readName(&c, name)) return false;
+        if(argcount > MACROMAXARGS) return false;
+        for(uint8_t i = 0; i < argcount; i++) {
+            if(!_readName(&c, name) || (strlen(name) > MACROARGLENGTH)) return false;
+        }
+        if(!_read(&c, &length, sizeof(length)) || ((size_t)(c.end - c.ptr) < length)) return false;
+        c.ptr += length;
+    }
+    return c.ptr == c.end;
+}
+
+// Show a line of the file, the way processContent shows the line of an error
+void _printSourceLine(contentitem_t *ci, uint16_t linenumber) {
+    char line[LINEMAX+1];
+    const char *ptr = ci->buffer;
+    const char *end = ci->buffer + ci->size;
+    const char *eol;
+    size_t length;
+
+    while((--linenumber > 0) && ptr && (ptr < end)) {
+        ptr = memchr(ptr, '\n', end - ptr);
+        if(ptr) ptr++;
+    }
+    if((ptr == NULL) || (ptr >= end)) return;
+    eol = memchr(ptr, '\n', end - ptr);
+    length = (eol ? eol : end) - ptr;
+    if(length > LINEMAX - 1) length = LINEMAX - 1;
+    memcpy(line, ptr, length);
+    line[length] = '\n';
+    line[length + 1] = 0;
+    colorPrintf(YELLOW, "%s", line);
+}
+
+void _applyDefinitions(_cursor_t *c, contentitem_t *ci, uint32_t labels, uint32_t macros) {
+    char name[256];
+    char arglist[MACROMAXARGS][MACROARGLENGTH + 1];
+    uint32_t value = 0, length = 0;
+    uint16_t line = 0;
+    uint8_t argcount = 0, local = 0; // validated before, the reads can't fail
+    contentitem_t *callerci = currentcontentitem;
+
+    currentcontentitem = ci; // errors are reported at the defining line, like when processing the file
+    while(labels--) {
+        _read(c, &value, sizeof(value));
+        _read(c, &line, sizeof(line));
+        _read(c, &local, 1);
+        _readName(c, name);
+        ci->currentlinenumber = line;
+        if(!insertLabel(name, strlen(name), value, local)) {
+            error(message[ERROR_CREATINGLABEL],0);
+            _printSourceLine(ci, line);
+            ci->currentlinenumber = 0;
+            currentcontentitem = callerci;
+            return;
+        }
+    }
+    while(macros--) {
+        _read(c, &argcount, 1);
+        _read(c, &line, sizeof(line));
+        _readName(c, name);
+        for(uint8_t i = 0; i < argcount; i++) _readName(c, arglist[i]);
+        _read(c, &length, sizeof(length));
+        ci->currentlinenumber = line;
+        if(!restoreMacro(name, (const char *)c->ptr, length, argcount, (char *)arglist, line)) {
+            error(message[ERROR_MACROMEMORYALLOCATION],0);
+            break;
+        }
+        c->ptr += length;
+    }
+    ci->currentlinenumber = 0;
+    currentcontentitem = callerci;
+}
+
+char *_readEntry(const char *path, uint24_t *size) {
+    char *buffer;
+    FILE *fh;
+
+    *size = 0;
+    fh = fopen(path, "rb");
+    if(fh == NULL) return NULL;
+    *size = ioGetfilesize(fh);
+    buffer = (char *)malloc(*size);
+    if(buffer && (fread(buffer, 1, *size, fh) != *size)) {
+        free(buffer);
+        buffer = NULL;
+    }
+    fclose(fh);
+    return buffer;
+}
+
+// Replay the definitions of an include file from the cache, returns false when the file needs processing
+bool includeCacheReplay(contentitem_t *ci) {
+    char path[FILENAMEMAXLENGTH + 32];
+    char name[256];
+    includestate_t state, entrystate;
+    uint32_t counts[3];
+    _cursor_t c;
+    char *buffer;
+    uint24_t size;
+    bool hit = false;
+
+    includeCacheInvalidate(); // an include file can't be cached when it includes another file
+    includerecording = false;
+
+    _entryState(ci, &state);
+    if(!_entryPath(path, sizeof(path), ci, &state)) return false;
+    buffer = _readEntry(path, &size);
+    if(buffer) {
+        c.ptr = (const uint8_t *)buffer;
+        c.end = c.ptr + size;
+        hit = _read(&c, name, strlen(INCLUDECACHE_MAGIC)) && (memcmp(name, INCLUDECACHE_MAGIC, strlen(INCLUDECACHE_MAGIC)) == 0);
+        hit = hit && _read(&c, &entrystate, sizeof(includestate_t)) && (memcmp(&entrystate, &state, sizeof(includestate_t)) == 0);
+        hit = hit && _readName(&c, name) && (strcmp(name, ci->name) == 0);
+        hit = hit && _read(&c, counts, sizeof(counts));
+        hit = hit && _validDependencies(&c, counts[0]) && _validDefinitions(c, counts[1], counts[2]);
+        if(hit) {
+            _applyDefinitions(&c, ci, counts[1], counts[2]);
+            ci->replayed = true;
+        }
+        free(buffer);
+    }
+    if(hit) includeCacheHits++;
+    else includeCacheMisses++;
+    return hit;
+}
+
+// Start recording the definitions of an include file, during the first pass
+void includeCacheRecord(contentitem_t *ci) {
+    includerecording = true;
+    _cacheable = true;
+    _recordci = ci;
+    _recordlevel = contentlevel;
+    _entryState(ci, &_entrystate);
+    _entryoutputposition = ioGetOutputPosition() + remaining_dsspaces;
+    _entryfillbyte = fillbyte;
+    _entrybinfilecount = binfilecount;
+    _entryexpandid = macroExpandID;
+    _entryanonymouslabels = getAnonymousLabelCount();
+    _definedcount = 0;
+    _usedcount = 0;
+    _macrocount = 0;
+}
+
+void includeCacheInvalidate(void) {
+    _cacheable = false;
+}
+
+void includeCacheLabelDefined(label_t *lbl) {
+    uint16_t *lines;
+
+    if(_definedcount == _definedcapacity) { // grows along with _defined
+        lines = (uint16_t *)realloc(_definedlines, (_definedcapacity ? _definedcapacity * 2 : 64) * sizeof(uint16_t));
+        if(lines == NULL) {
+            _cacheable = false;
+            return;
+        }
+        _definedlines = lines;
+    }
+    if(!_append((void ***)&_defined, &_definedcount, &_definedcapacity, lbl)) {
+        _cacheable = false;
+        return;
+    }
+    _definedlines[_definedcount - 1] = currentcontentitem->currentlinenumber;
+}
+
+void includeCacheLabelUsed(label_t *lbl) {
+    if(!_append((void ***)&_used, &_usedcount, &_usedcapacity, lbl)) _cacheable = false;
+}
+
+void includeCacheMacroDefined(macro_t *m) {
+    if(!_append((void ***)&_macros, &_macrocount, &_macrocapacity, m)) _cacheable = false;
+}
+
+// Only the definitions are replayed, so the file can't have changed anything else
+bool _stateUnchanged(void) {
+    includestate_t state;
+
+    _entryState(_recordci, &state);
+    return (memcmp(&state, &_entrystate, sizeof(includestate_t)) == 0) &&
+           (ioGetOutputPosition() + remaining_dsspaces == _entryoutputposition) &&
+           (fillbyte == _entryfillbyte) &&
+           (binfilecount == _entrybinfilecount) &&
+           (macroExpandID == _entryexpandid) &&
+           (getAnonymousLabelCount() == _entryanonymouslabels) &&
+           (inConditionalSection == CONDITIONSTATE_NORMAL);
+}
+
+// Labels used from outside the file, each once
+uint32_t _dependencies(void) {
+    label_t **defined;
+    uint32_t count = 0;
+
+    defined = (label_t **)malloc((_definedcount + 1) * sizeof(label_t *));
+    if(defined == NULL) return 0;
+    memcpy(defined, _defined, _definedcount * sizeof(label_t *));
+    qsort(defined, _definedcount, sizeof(label_t *), _comparePointers);
+    qsort(_used, _usedcount, sizeof(label_t *), _comparePointers);
+    for(uint24_t i = 0; i < _usedcount; i++) {
+        if((i > 0) && (_used[i] == _used[i - 1])) continue;
+        if(bsearch(&_used[i], defined, _definedcount, sizeof(label_t *), _comparePointers)) continue;
+        _used[count++] = _used[i];
+    }
+    free(defined);
+    return count;
+}
+
+void _writeEntry(const char *path) {
+    char tmppath[FILENAMEMAXLENGTH + 48];
+    uint32_t counts[3], value;
+    uint16_t line;
+    uint8_t local;
+    macro_t *m;
+    FILE *fh;
+    bool written;
+
+    // Written under a temporary name, so a parallel assembly never reads a partial entry
+    #ifdef UNIX
+    snprintf(tmppath, sizeof(tmppath), "%s.%d", path, (int)getpid());
+    #else
+    snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+    #endif
+    fh = fopen(tmppath, "wb");
+    if(fh == NULL) return;
+
+    counts[0] = _dependencies();
+    counts[1] = _definedcount;
+    counts[2] = _macrocount;
+    fwrite(INCLUDECACHE_MAGIC, 1, strlen(INCLUDECACHE_MAGIC), fh);
+    fwrite(&_entrystate, 1, sizeof(includestate_t), fh);
+    _writeName(fh, _recordci->name);
+    fwrite(counts, 1, sizeof(counts), fh);
+    for(uint32_t i = 0; i < counts[0]; i++) {
+        value = _used[i]->address;
+        fwrite(&value, 1, sizeof(value), fh);
+        _writeName(fh, _used[i]->name);
+    }
+    for(uint32_t i = 0; i < counts[1]; i++) {
+        value = _defined[i]->address;
+        local = _defined[i]->local;
+        fwrite(&value, 1, sizeof(value), fh);
+        fwrite(&_definedlines[i], 1, sizeof(uint16_t), fh);
+        fwrite(&local, 1, 1, fh);
+        _writeName(fh, _defined[i]->name);
+    }
+    for(uint32_t i = 0; i < counts[2]; i++) {
+        m = _macros[i];
+        value = strlen(m->body);
+        line = m->originlinenumber;
+        fwrite(&m->argcount, 1, 1, fh);
+        fwrite(&line, 1, sizeof(line), fh);
+        _writeName(fh, m->name);
+        for(uint8_t a = 0; a < m->argcount; a++) _writeName(fh, m->arguments[a]);
+        fwrite(&value, 1, sizeof(value), fh);
+        fwrite(m->body, 1, value, fh);
+    }
+    written = (ferror(fh) == 0);
+    if(fclose(fh)) written = false;
+
+    #ifndef UNIX
+    if(written) remove(path);
+    #endif
+    if(!written || rename(tmppath, path)) remove(tmppath);
+}
+
+// End of an include file, store its definitions when it can be replayed
+void includeCacheEnd(contentitem_t *ci) {
+    char path[FILENAMEMAXLENGTH + 32];
+
+    if(!includerecording || (ci != _recordci) || (contentlevel != _recordlevel)) return;
+    includerecording = false;
+    if(!_cacheable || errorcount || !_stateUnchanged()) return;
+    if(_entryPath(path, sizeof(path), ci, &_entrystate)) _writeEntry(path);
+}
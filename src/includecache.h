@@ -0,0 +1,20 @@
+#ifndef INCLUDECACHE_H
+#define INCLUDECACHE_H
+
+#include "defines.h"
+
+extern bool     includerecording;
+extern uint24_t includeCacheHits;
+extern uint24_t includeCacheMisses;
+
+void initIncludeCache(void);
+bool includeCacheEnabled(void);
+bool includeCacheReplay(contentitem_t *ci);
+void includeCacheRecord(contentitem_t *ci);
+void includeCacheEnd(contentitem_t *ci);
+void includeCacheLabelDefined(label_t *lbl);
+void includeCacheLabelUsed(label_t *lbl);
+void includeCacheMacroDefined(macro_t *m);
+void includeCacheInvalidate(void);
+
+#endif // INCLUDECACHE_H
@@ -14,9 +14,7 @@
 #include "label.h"
 #include "io.h"
 #include "instruction.h"
-
-// instruction hash table
-instruction_t *instruction_table[INSTRUCTION_HASHTABLESIZE];
+#include "instructionhash.h"
 
 // get the number of bytes to emit from an immediate
 uint8_t get_immediate_size(uint8_t suffix) {
@@ -104,7 +102,8 @@ void transform_instruction(operand_t *op, uint8_t type) {
             op->immediate_provided = false; // no separate output for this transform
             break;
         case TRANSFORM_REL:
-            if(pass == ENDPASS) {
+            macroExpansionPure = false; // relative to the current address
+            if(finalValues()) {
                 // label still potentially unknown in pass 1, so output the existing '0' in pass 1
                 if(relocate) {
                    rel = op->immediate - (relocateBaseAddress + (address - relocateOutputBaseAddress)) - 2;
@@ -835,7 +834,9 @@ operandlist_t operands_xor[] = {
    { RS_IXY,            INDIRECT,RS_NONE,               NOREQ,  TRANSFORM_NONE,TRANSFORM_NONE,F_DISPA|F_DDFDOK|S_ANY,BIT_Z80,0x00,0xAE},
 };
 
-instruction_t instructions[] = {
+// Mnemonics and directives in alphabetical order, lowercase.
+// Run 'make instructionhash' after changing this list
+const instruction_t instructions[] = {
     {"adc",         EZ80, 0, sizeof(operands_adc)/sizeof(operandlist_t), operands_adc,NULL,NULL},
     {"add",         EZ80, 0, sizeof(operands_add)/sizeof(operandlist_t), operands_add,NULL,NULL},
     {"align",       ASSEMBLER, ASM_ALIGN, 0, NULL,NULL,NULL},
@@ -983,46 +984,17 @@ instruction_t instructions[] = {
     {"xor",         EZ80, 0, sizeof(operands_xor)/sizeof(operandlist_t), operands_xor,NULL,NULL}
 };
 
-instruction_t * instruction_lookup(const char *name) {
-    uint8_t index;
-    instruction_t *try;
-
-    index = lowercaseHash256(name);
-    try = instruction_table[index];
-
-    while(true)
-    {
-        if(try == NULL) return NULL;
-        if(strcasecmp(try->name, name) == 0) return try;
-        try = try->next;
-    }
-}
+// Fails to compile when instructionhash.h doesn't match the list above
+typedef char instructionhash_outdated[((sizeof(instructions) / sizeof(instruction_t)) == INSTRUCTION_HASH_COUNT) ? 1 : -1];
 
-void initInstructionTable(void) {
-    uint16_t n;
-    uint8_t index;
-    instruction_t *try;
-
-    memset(instruction_table, 0, sizeof(instruction_table));
-
-    for(n = 0; n < (sizeof(instructions) / sizeof(instruction_t)); n++) {
-      index = lowercaseHash256(instructions[n].name);
-      try = instruction_table[index];
-
-      // First item on index
-      if(try == NULL) {
-         instruction_table[index] = &instructions[n];
-      }
-      else {
-         while(true) {
-            if(try->next) {
-                  try = try->next;
-            }
-            else {
-                  try->next = &instructions[n];
-                  break;
-            }
-         }
-      }
-   }
+// Collision-free lookup of mnemonics and directives in the generated table, then macros
+instruction_t * instruction_lookup(const char *name) {
+    char lowercase[MAX_MNEMONIC_SIZE];
+    uint16_t hash;
+    uint8_t slot;
+
+    hash = lowercaseHash16(name, lowercase, sizeof(lowercase), INSTRUCTION_HASH_SEED);
+    slot = instruction_hash_slots[(hash & 0xFF) ^ instruction_hash_displacement[(hash >> 8) & (INSTRUCTION_HASH_BUCKETS - 1)]];
+    if(slot && (strcmp(instructions[slot - 1].name, lowercase) == 0)) return (instruction_t *)&instructions[slot - 1];
+    return macro_lookup(name);
 }
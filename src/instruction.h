@@ -5,10 +5,7 @@
 #include "defines.h"
 
 instruction_t * instruction_lookup(const char *name);
-void initInstructionTable(void);
 void emit_instruction(const operandlist_t *list);
 uint8_t get_immediate_size(uint8_t suffix);
 
-extern instruction_t *instruction_table[INSTRUCTION_HASHTABLESIZE];
-
 #endif // INSTRUCTION_H
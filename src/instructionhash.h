@@ -0,0 +1,36 @@
+// Generated by tools/mkinstructionhash.c from src/instruction.c - do not edit
+// 145 mnemonics and directives, 16 buckets
+#ifndef INSTRUCTIONHASH_H
+#define INSTRUCTIONHASH_H
+
+#define INSTRUCTION_HASH_COUNT     145
+#define INSTRUCTION_HASH_SEED      12
+#define INSTRUCTION_HASH_BUCKETS   16
+#define INSTRUCTION_HASH_MAXLENGTH 11
+
+// Displacement per bucket, selected by the upper byte of lowercaseHash16()
+static const uint8_t instruction_hash_displacement[16] = {
+      0,  45,   3,   8,  88,   0, 220,   1,  59,  28,  12,   0,  34, 100,  10, 151
+};
+
+// Index+1 in instructions[] per slot, 0 for an empty slot
+static const uint8_t instruction_hash_slots[256] = {
+      0,   0,   0, 116,   6,  25,   5, 117,   0,  65,   0,  14, 121,  75,   1,  92, 
+      0,   0,  77,   0,  70,   0,  21,   0,   4, 130,   0,  49, 137,  29,  74,   0, 
+      0,   0, 134,   0,  64, 125,   7,  45,  38,   0,  39,  95,  76,  80,  52,   0, 
+     55,   0,   0,   0,   0,  84,   0,   0, 115,  93, 103,   0,  16,  41,   0,  40, 
+      0,   0,  69, 108,  90,   0,   0,  63, 123, 120,  19,   0,   0,  57,   0,  85, 
+      0, 106, 118,   0,   0,   0,  24,  83,   0,   0,  56,   0,   2,  35,  30,   0, 
+      0,  36,  13,  60, 119,  33,  98,   0,   3,   0, 100,  37,   0,   0, 101,   9, 
+     88, 127,   0, 135,   8,   0,  54,   0,   0,   0,   0,  50,   0,  51,   0, 129, 
+      0,  43,   0,   0,  89,   0,   0, 133, 142,   0,   0,   0,   0,  97,  91,  15, 
+     42, 113, 138,  18,  20,  46,   0,   0,   0,  12,   0,  99, 126,  62,   0,  17, 
+      0,   0,   0,  71,   0,   0,   0,   0,  78, 105,   0,  44,   0, 104,   0,   0, 
+     32,   0,   0,   0,   0, 111,   0,  58,   0,   0,   0,   0,   0,   0,   0,   0, 
+      0,  59,   0,  34,  22,   0,   0, 128,  81,   0,  27, 122, 124,  61,  86,  79, 
+    131, 145,   0, 102,  68, 132,  87, 141,  23,  26,   0, 140,   0,   0,   0,  10, 
+      0,   0,   0,  31,  82,  66,  28,  67, 139,   0, 143, 144, 110,  47, 107,  96, 
+    114,  53,   0,  73,   0, 112,  94,   0,  72,   0,  48,  11, 136,   0, 109,   0
+};
+
+#endif // INSTRUCTIONHASH_H
@@ -1,8 +1,22 @@
+#if defined(UNIX) && defined(__linux__)
+#define _GNU_SOURCE // copy_file_range
+#endif
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdint.h>
 #include <stdbool.h>
+#ifdef UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <limits.h>
+#endif
+#if defined(UNIX) && defined(__linux__)
+#include <sys/sendfile.h>
+#endif
 #include "config.h"
 #include "defines.h"
 #include "globals.h"
@@ -12,6 +26,10 @@
 #include "moscalls.h"
 #include "io.h"
 #include "instruction.h"
+#include "arena.h"
+#if defined(UNIX) && defined(__linux__)
+#include "watch.h"
+#endif
 
 // File basename variable
 char filebasename[FILENAMEMAXLENGTH + 1];
@@ -20,6 +38,10 @@ char filebasename[FILENAMEMAXLENGTH + 1];
 char     filename[OUTPUTFILES][FILENAMEMAXLENGTH + 1];
 FILE*    filehandle[OUTPUTFILES];
 contentitem_t *filecontent[256]; // hash table with all file content items
+arena_t  contentarena;            // file content items, names and buffers
+memorysource_t *memorysources;    // file content provided in memory, used instead of files with the same name
+bool     memoryoutput;            // output and listing go to temporary files, to be read back into memory
+bool     keepcontent;             // server mode, file mappings are kept between assemblies
 
 // Local variables
 char *   _bufferstart[OUTPUTFILES];          // statically set start of buffer to each file
@@ -27,6 +49,9 @@ char *   _filebuffer[OUTPUTFILES];            // actual moving pointers in buffe
 uint24_t _filebuffersize[OUTPUTFILES];        // current fill size of each buffer
 bool     _fileEOF[OUTPUTFILES];
 char     _outputbuffer[OUTPUT_BUFFERSIZE];
+char     _listingbuffer[OUTPUT_BUFFERSIZE];
+uint24_t _outputflushed;                     // bytes flushed to the output file before the current buffer
+uint24_t _outputsize;                        // highest position written to the output file, including holes
 
 #ifdef AGONDEV
     // platform-specific for Agon AGONDEV
@@ -39,6 +64,9 @@ FILE *ioOpenfile(const char *name, const char *mode) {
     FILE *fh = fopen(name, mode);
     if(!fh) {
         error("Error opening", "%s", name);
+        #if defined(UNIX) && defined(__linux__)
+        if(watching && (mode[0] == 'r')) watchMissingFile(name);
+        #endif
     }
     return fh;
 }
@@ -58,22 +86,163 @@ uint24_t ioGetfilesize(FILE *fh) {
     return filesize;
 }
 
+memorysource_t *_findMemorySource(const char *name) {
+    memorysource_t *ms;
+
+    for(ms = memorysources; ms; ms = ms->next) {
+        if(strcmp(ms->name, name) == 0) return ms;
+    }
+    return NULL;
+}
+
+#ifdef UNIX
+contentcache_t *_contentcache;
+
+int64_t _modificationTime(const struct stat *st) {
+    #ifdef __linux__
+    return ((int64_t)st->st_mtim.tv_sec * 1000000000) + st->st_mtim.tv_nsec;
+    #else
+    return (int64_t)st->st_mtime * 1000000000;
+    #endif
+}
+
+// Use a mapping from a previous assembly if the file is unchanged, or drop it when it changed
+// The cache owns its mappings, these aren't released after an assembly
+bool _cachedContent(contentitem_t *ci, const struct stat *st, char *path) {
+    contentcache_t *cc;
+
+    if(realpath(ci->name, path) == NULL) {
+        path[0] = 0;
+        return false;
+    }
+    for(cc = _contentcache; cc; cc = cc->next) {
+        if(strcmp(cc->path, path)) continue;
+        if((cc->inode == st->st_ino) && (cc->mtime == _modificationTime(st)) && (cc->size == st->st_size)) {
+            ci->buffer = cc->buffer;
+            ci->size = cc->size;
+            return true;
+        }
+        munmap(cc->buffer, cc->size);
+        cc->buffer = NULL;
+        cc->size = 0;
+        return false;
+    }
+    return false;
+}
+
+void _cacheContent(contentitem_t *ci, const struct stat *st, const char *path) {
+    contentcache_t *cc;
+
+    for(cc = _contentcache; cc; cc = cc->next) {
+        if(strcmp(cc->path, path) == 0) break;
+    }
+    if(cc == NULL) {
+        cc = (contentcache_t *)malloc(sizeof(contentcache_t));
+        if(cc == NULL) return;
+        cc->path = (char *)malloc(strlen(path) + 1);
+        if(cc->path == NULL) {
+            free(cc);
+            return;
+        }
+        strcpy(cc->path, path);
+        cc->next = _contentcache;
+        _contentcache = cc;
+    }
+    cc->inode = st->st_ino;
+    cc->mtime = _modificationTime(st);
+    cc->size = ci->size;
+    cc->buffer = ci->buffer;
+    ci->mapped = false;
+}
+
+// Map the file into memory, instead of reading it into an allocated buffer.
+// The mapping is read-only and isn't terminated by a zero byte
+bool _mapContent(contentitem_t *ci) {
+    char path[PATH_MAX];
+    struct stat st;
+    void *map;
+    int fd;
+
+    path[0] = 0;
+    fd = open(ci->name, O_RDONLY);
+    if(fd < 0) {
+        error("Error opening", "%s", ci->name);
+        #ifdef __linux__
+        if(watching) watchMissingFile(ci->name);
+        #endif
+        return false;
+    }
+    if(fstat(fd, &st) || (st.st_size == 0) || (st.st_size > 0xFFFFFF)) {
+        close(fd);
+        return false; // read empty files, or files that can't be mapped, the regular way
+    }
+    if(keepcontent && _cachedContent(ci, &st, path)) {
+        close(fd);
+        return true;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) return false;
+    ci->buffer = (char *)map;
+    ci->size = st.st_size;
+    ci->mapped = true;
+    if(keepcontent && path[0]) _cacheContent(ci, &st, path);
+    return true;
+}
+#endif
+
+// Read the complete file content into ci->buffer
+bool ioReadContent(contentitem_t *ci) {
+    memorysource_t *ms;
+
+    ci->mapped = false;
+    if((ms = _findMemorySource(ci->name))) { // used in place, like a read-only mapping
+        ci->buffer = (char *)ms->buffer;
+        ci->size = ms->size;
+        return true;
+    }
+
+    #ifdef UNIX
+    if(_mapContent(ci)) return true;
+    if(errorcount) return false;
+    #endif
+
+    ci->fh = ioOpenfile(ci->name, "rb");
+    if(ci->fh == 0) return false;
+    ci->size = ioGetfilesize(ci->fh);
+    ci->buffer = arenaAllocate(&contentarena, ci->size+1);
+    if(ci->buffer == NULL) return false;
+    if(fread(ci->buffer, 1, ci->size, ci->fh) != ci->size) {
+        error(message[ERROR_READINGINPUT],0);
+        return false;
+    }
+    ci->buffer[ci->size] = 0; // terminate stringbuffer
+    fclose(ci->fh);
+    return true;
+}
+
 void _initFileBuffers(void) {
     int n;
 
     for(n = 0; n < OUTPUTFILES; n++) _bufferstart[n] = 0;
     _bufferstart[FILE_OUTPUT] = _outputbuffer;
+    _bufferstart[FILE_LISTING] = _listingbuffer;
 
     for(n = 0; n < OUTPUTFILES; n++) {
         _filebuffer[n] = _bufferstart[n];
         _filebuffersize[n] = 0;
         _fileEOF[n] = false;
     }
+    _outputflushed = 0;
+    _outputsize = 0;
 }
 
 // opens a file a places the result at the file pointer
 bool _openFile(uint8_t filenumber, const char* mode) {
-    FILE* file = fopen(filename[filenumber], mode);
+    FILE* file;
+
+    if(memoryoutput && (filenumber != FILE_ANONYMOUS_LABELS)) file = tmpfile();
+    else file = fopen(filename[filenumber], mode);
     filehandle[filenumber] = file;
     if(file) return true;
     else return false;
@@ -104,16 +273,17 @@ void _prepare_filenames(const char *output_filename) {
 }
 
 void _deleteFiles(void) {
-    if(CLEANUPFILES) {
+    if(CLEANUPFILES && filehandle[FILE_ANONYMOUS_LABELS]) {
         remove(filename[FILE_ANONYMOUS_LABELS]);
     }
-    if(errorcount && CLEANUPFILES) remove(filename[FILE_OUTPUT]);
+    if(errorcount && CLEANUPFILES && !memoryoutput) remove(filename[FILE_OUTPUT]);
 }
 
 void _closeAllFiles(void) {
-    if(filehandle[FILE_OUTPUT]) fclose(filehandle[FILE_OUTPUT]);
-    if(filehandle[FILE_ANONYMOUS_LABELS]) fclose(filehandle[FILE_ANONYMOUS_LABELS]);
-    if(list_enabled && filehandle[FILE_LISTING]) fclose(filehandle[FILE_LISTING]);
+    for(int fh = 0; fh < OUTPUTFILES; fh++) {
+        if(filehandle[fh]) fclose(filehandle[fh]);
+        filehandle[fh] = NULL;
+    }
 }
 
 bool _openfiles(void) {
@@ -122,11 +292,16 @@ bool _openfiles(void) {
         _closeAllFiles();
         return false;
     }
-    if(!_openFile(FILE_ANONYMOUS_LABELS, "wb+")) {
-        error("Error creating anonymous labels file", 0);
-        _closeAllFiles();
-        return false;
+    #ifdef AGONDEV
+    // Only spill anonymous labels to disk in the minimum memory configuration
+    if(!completefilebuffering) {
+        if(!_openFile(FILE_ANONYMOUS_LABELS, "wb+")) {
+            error("Error creating anonymous labels file", 0);
+            _closeAllFiles();
+            return false;
+        }
     }
+    #endif
     if(list_enabled) {
         if(!_openFile(FILE_LISTING, "w")) {
             error("Error creating listing file", 0);
@@ -141,6 +316,10 @@ bool _openfiles(void) {
 // These files will have a buffer set up previously
 void _io_flush(uint8_t fh) {
     fwrite(_bufferstart[fh], 1, _filebuffersize[fh], filehandle[fh]);
+    if(fh == FILE_OUTPUT) {
+        _outputflushed += _filebuffersize[fh];
+        if(_outputflushed > _outputsize) _outputsize = _outputflushed;
+    }
     _filebuffer[fh] = _bufferstart[fh];
     _filebuffersize[fh] = 0;
 }
@@ -148,7 +327,7 @@ void _io_flush(uint8_t fh) {
 // Flush all output files
 void _io_flushOutput(void) {
     for(int fh = 0; fh < OUTPUTFILES; fh++) {
-        if(_bufferstart[fh]) _io_flush(fh);
+        if(_bufferstart[fh] && filehandle[fh]) _io_flush(fh);
     }
 }
 
@@ -163,31 +342,139 @@ void ioPutc(uint8_t fh, unsigned char c) {
     else fputc(c, filehandle[fh]); // regular non-buffered IO
 }
 
+// Current position in the output file, including buffered output
+uint24_t ioGetOutputPosition(void) {
+    return _outputflushed + _filebuffersize[FILE_OUTPUT];
+}
+
+// Flush buffered output and continue output at the given position in the output file
+void ioSeekOutput(uint24_t position) {
+    _io_flush(FILE_OUTPUT);
+    if(fseek(filehandle[FILE_OUTPUT], position, SEEK_SET)) {
+        error(message[ERROR_FILEIO],"%s",filename[FILE_OUTPUT]);
+        return;
+    }
+    _outputflushed = position;
+}
+
 void io_outputc(unsigned char c) {
     *(_filebuffer[FILE_OUTPUT]++) = c;
     _filebuffersize[FILE_OUTPUT]++;
     if(_filebuffersize[FILE_OUTPUT] == OUTPUT_BUFFERSIZE) _io_flush(FILE_OUTPUT);
 }
 
+// Output a run of identical bytes, filling the output buffer in blocks
+void ioFill(uint8_t value, uint24_t count) {
+    uint24_t n;
+
+    #ifdef UNIX
+    // Skip over large zero runs, leaving a hole in the file
+    if((value == 0) && (count >= OUTPUT_BUFFERSIZE)) {
+        _io_flush(FILE_OUTPUT);
+        if(fseek(filehandle[FILE_OUTPUT], count, SEEK_CUR) == 0) {
+            _outputflushed += count;
+            if(_outputflushed > _outputsize) _outputsize = _outputflushed;
+            return;
+        }
+    }
+    #endif
+    while(count) {
+        n = OUTPUT_BUFFERSIZE - _filebuffersize[FILE_OUTPUT];
+        if(n > count) n = count;
+        memset(_filebuffer[FILE_OUTPUT], value, n);
+        _filebuffer[FILE_OUTPUT] += n;
+        _filebuffersize[FILE_OUTPUT] += n;
+        count -= n;
+        if(_filebuffersize[FILE_OUTPUT] == OUTPUT_BUFFERSIZE) _io_flush(FILE_OUTPUT);
+    }
+}
+
 void  ioWrite(uint8_t fh, const char *s, uint24_t size) {
+    uint24_t n;
+
     if(_bufferstart[fh]) {
-        // Buffered IO
-        while(size--) {
-            *(_filebuffer[fh]++) = *s++;
-            _filebuffersize[fh]++;
+        // Buffered IO, copy as much as fits in the buffer at once
+        while(size) {
+            n = OUTPUT_BUFFERSIZE - _filebuffersize[fh];
+            if(n > size) n = size;
+            memcpy(_filebuffer[fh], s, n);
+            _filebuffer[fh] += n;
+            _filebuffersize[fh] += n;
+            s += n;
+            size -= n;
             if(_filebuffersize[fh] == OUTPUT_BUFFERSIZE) _io_flush(fh);
         }
     }
     else fwrite(s, 1, size, filehandle[fh]);
 }
 
-int ioPuts(uint8_t fh, const char *s) {
-    int number = 0;
-    while(*s) {
-        ioPutc(fh, *s);
-        number++;
-        s++;
+#if defined(UNIX) && defined(__linux__)
+// Let the kernel copy between the files, returns the number of bytes copied
+uint24_t _copyFileRange(int in, int out, uint24_t offset, uint24_t length) {
+    off_t inpos = offset;
+    uint24_t copied = 0;
+    ssize_t n;
+
+    while(copied < length) {
+        n = copy_file_range(in, &inpos, out, NULL, length - copied, 0);
+        if(n <= 0) break; // not supported between these files
+        copied += n;
+    }
+    while(copied < length) {
+        n = sendfile(out, in, &inpos, length - copied);
+        if(n <= 0) break;
+        copied += n;
+    }
+    return copied;
+}
+#endif
+
+// Copy part of a file directly to the output file, bypassing the output buffer
+bool ioCopyFile(const char *name, uint24_t offset, uint24_t length) {
+    char buffer[INPUT_BUFFERSIZE];
+    FILE *fh;
+    memorysource_t *ms;
+    uint24_t copied = 0;
+    size_t n;
+
+    // Pending DS space comes before the file content
+    ioFill(fillbyte, remaining_dsspaces);
+    remaining_dsspaces = 0;
+
+    if((ms = _findMemorySource(name))) {
+        if((offset > ms->size) || (length > ms->size - offset)) return false;
+        ioWrite(FILE_OUTPUT, ms->buffer + offset, length);
+        return true;
     }
+    _io_flush(FILE_OUTPUT);
+
+    fh = ioOpenfile(name, "rb");
+    if(fh == 0) return false;
+
+    #if defined(UNIX) && defined(__linux__)
+    fflush(filehandle[FILE_OUTPUT]);
+    copied = _copyFileRange(fileno(fh), fileno(filehandle[FILE_OUTPUT]), offset, length);
+    if(copied) fseek(filehandle[FILE_OUTPUT], _outputflushed + copied, SEEK_SET); // sync the stream with the file position
+    #endif
+
+    // Fallback, copy in chunks
+    if(copied < length) fseek(fh, offset + copied, SEEK_SET);
+    while(copied < length) {
+        n = fread(buffer, 1, ((length - copied) < INPUT_BUFFERSIZE) ? (length - copied) : INPUT_BUFFERSIZE, fh);
+        if(n == 0) break;
+        fwrite(buffer, 1, n, filehandle[FILE_OUTPUT]);
+        copied += n;
+    }
+    fclose(fh);
+    _outputflushed += copied;
+    if(_outputflushed > _outputsize) _outputsize = _outputflushed;
+    return (copied == length);
+}
+
+int ioPuts(uint8_t fh, const char *s) {
+    int number = strlen(s);
+
+    ioWrite(fh, s, number);
     return number;
 }
 
@@ -198,27 +485,101 @@ bool ioInit(const char *input_filename, const char *output_filename) {
     return _openfiles();
 }
 
-void ioClose(void) {
+#ifdef UNIX
+// A hole at the end of the output isn't part of the file yet, extend the file to its full size
+void _extendOutput(void) {
+    struct stat st;
+
+    if(filehandle[FILE_OUTPUT] == NULL) return;
+    fflush(filehandle[FILE_OUTPUT]);
+    if(fstat(fileno(filehandle[FILE_OUTPUT]), &st) == 0) {
+        if((uint24_t)st.st_size < _outputsize) {
+            if(ftruncate(fileno(filehandle[FILE_OUTPUT]), _outputsize)) {}
+        }
+    }
+}
+#endif
+
+// Write all buffered output to the output files
+void ioFlush(void) {
     _io_flushOutput();
+    #ifdef UNIX
+    _extendOutput();
+    #endif
+}
+
+// Read the complete content of a written file into allocated memory, freed by the caller
+// The content is zero-terminated, for use as text
+char *ioReadStream(FILE *fh, uint24_t *size) {
+    char *buffer;
+
+    *size = 0;
+    if(fh == NULL) return NULL;
+    fflush(fh);
+    *size = ioGetfilesize(fh);
+    buffer = (char *)malloc(*size + 1);
+    if(buffer == NULL) {
+        *size = 0;
+        return NULL;
+    }
+    *size = fread(buffer, 1, *size, fh);
+    buffer[*size] = 0;
+    return buffer;
+}
+
+void ioClose(void) {
+    ioFlush();
     _closeAllFiles();
     _deleteFiles();
 }
 
 void emit_8bit(uint8_t value) {
-    if(pass == ENDPASS) {
+    if((pass == ENDPASS) || singlepass) {
         if(remaining_dsspaces) {
             if(listing) listPrintDSLines(remaining_dsspaces, fillbyte);
-            while(remaining_dsspaces) {
-                io_outputc(fillbyte);
-                remaining_dsspaces--;
-            }
+            ioFill(fillbyte, remaining_dsspaces);
+            remaining_dsspaces = 0;
         }
         if(listing) listEmit8bit(value);
+        if(macrolevel) macroCaptureByte(value);
         io_outputc(value);
     }
     address++;
 }
 
+// Emit a run of identical bytes
+void emit_fill(uint8_t value, uint24_t count) {
+    if(count == 0) return;
+    if((pass == ENDPASS) || singlepass) {
+        if(remaining_dsspaces) {
+            if(listing) listPrintDSLines(remaining_dsspaces, fillbyte);
+            ioFill(fillbyte, remaining_dsspaces);
+            remaining_dsspaces = 0;
+        }
+        if(listing) listEmitFill(value, count);
+        ioFill(value, count);
+    }
+    address += count;
+}
+
+// Emit a run of bytes
+void emit_bytes(const uint8_t *data, uint24_t count) {
+    if(count == 0) return;
+    if((pass == ENDPASS) || singlepass) {
+        if(remaining_dsspaces) {
+            if(listing) listPrintDSLines(remaining_dsspaces, fillbyte);
+            ioFill(fillbyte, remaining_dsspaces);
+            remaining_dsspaces = 0;
+        }
+        if(listing) listEmitBytes(data, count);
+        if(macrolevel) {
+            for(uint24_t i = 0; i < count; i++) macroCaptureByte(data[i]);
+        }
+        ioWrite(FILE_OUTPUT, (const char *)data, count);
+    }
+    address += count;
+}
+
 void emit_16bit(uint16_t value) {
     emit_8bit(value&0xFF);
     emit_8bit((value>>8)&0xFF);
@@ -261,32 +622,44 @@ void emit_adlsuffix_code(uint8_t suffix) {
 
 // emits a string surrounded by literal string quotes, as the token gets in from a file
 // Only called when the first character is a double quote
+// Decode the string into a buffer and emit it in runs
 void emit_quotedstring(const char *str) {
+    uint8_t buffer[LINEMAX];
+    uint24_t length = 0;
     bool escaped = false;
     uint8_t escaped_char;
 
     str++; // skip past first "
     while(*str) {
+        if(length == LINEMAX) {
+            emit_bytes(buffer, length);
+            length = 0;
+        }
         if(!escaped) {
             if(*str == '\\') { // escape character
                 escaped = true;
             }
             else {
-                if(*str == '\"') return;
-                else emit_8bit(*str);
+                if(*str == '\"') {
+                    emit_bytes(buffer, length);
+                    return;
+                }
+                else buffer[length++] = *str;
             }
         }
         else { // previously escaped
             escaped_char = getEscapedChar(*str);
             if(escaped_char == 0xff) {
+                emit_bytes(buffer, length);
                 error(message[ERROR_ILLEGAL_ESCAPESEQUENCE],0);
                 return;
             }
-            emit_8bit(escaped_char);
+            buffer[length++] = escaped_char;
             escaped = false;
         }
         str++;
     }
+    emit_bytes(buffer, length);
     // we missed an end-quote to this string, we shouldn't reach this
     error(message[ERROR_STRING_NOTTERMINATED],0);
 }
@@ -304,7 +677,17 @@ void emit_immediate(const operand_t *op, uint8_t suffix) {
 }
 
 void initFileContentTable(void) {
-    filecontentsize = 0;
+    #ifdef UNIX
+    contentitem_t *ci;
+
+    // Release file mappings from a previous assembly
+    for(int i = 0; i < 256; i++) {
+        for(ci = filecontent[i]; ci; ci = ci->next) {
+            if(ci->mapped) munmap(ci->buffer, ci->size);
+        }
+    }
+    #endif
+    initArena(&contentarena, &filecontentsize);
     memset(filecontent, 0, sizeof(filecontent));
 }
 
@@ -325,12 +708,12 @@ void seekContentInput(contentitem_t *ci, uint24_t position) {
     }
 }
 
-void openContentInput(contentitem_t *ci, char *buffer) {
+bool openContentInput(contentitem_t *ci, char *buffer) {
     if(!completefilebuffering) {
         ci->buffer = buffer;
         ci->bytesinbuffer = 0;
         ci->fh = ioOpenfile(ci->name, "rb");
-        if(ci->fh == 0) return;
+        if(ci->fh == 0) return false;
         ci->size = ioGetfilesize(ci->fh);
     }
     ci->currentlinenumber = 0;
@@ -341,6 +724,7 @@ void openContentInput(contentitem_t *ci, char *buffer) {
 
     currentcontentitem = ci;
     inConditionalSection = CONDITIONSTATE_NORMAL;
+    return true;
 }
 
 void closeContentInput(contentitem_t *ci, contentitem_t *callerci) {
@@ -11,15 +11,28 @@ extern bool consolelist_enabled;
 extern char filename[OUTPUTFILES][FILENAMEMAXLENGTH + 1];    // 0 - binary output, 3 - anonymous labels, 4 - listing
 extern FILE* filehandle[OUTPUTFILES];
 extern contentitem_t *filecontent[256]; // hash table with all file content items
+extern arena_t contentarena;
+extern memorysource_t *memorysources;
+extern bool memoryoutput;
+extern bool keepcontent;
 
 FILE *ioOpenfile(const char *name, const char *mode);
 uint24_t ioGetfilesize(FILE *fh);
+bool ioReadContent(contentitem_t *ci);
 void ioWrite(uint8_t fh, const char *s, uint24_t size);
+bool ioCopyFile(const char *name, uint24_t offset, uint24_t length);
+uint24_t ioGetOutputPosition(void);
+void ioSeekOutput(uint24_t position);
 bool ioInit(const char *input_filename, const char *output_filename); // init - called once at start
+void ioFlush(void);                                // write out all buffered output
+char *ioReadStream(FILE *fh, uint24_t *size);      // complete content of a written file, freed by the caller
 void ioClose(void);                                // close everything at end, do cleanup
 void ioPutc(uint8_t fh, unsigned char c);          // buffered write of a single byte / fallback
 int  ioPuts(uint8_t fh, const char *s);                  // buffered write of a string / fallback
+void ioFill(uint8_t value, uint24_t count);
 void emit_8bit(uint8_t value);
+void emit_fill(uint8_t value, uint24_t count);
+void emit_bytes(const uint8_t *data, uint24_t count);
 void emit_16bit(uint16_t value);
 void emit_24bit(uint24_t value);
 void emit_32bit(uint32_t value);
@@ -28,7 +41,7 @@ void emit_adlsuffix_code(uint8_t suffix);
 void emit_immediate(const operand_t *op, uint8_t suffix);
 void initFileContentTable(void);
 
-void openContentInput(contentitem_t *ci, char *buffer);
+bool openContentInput(contentitem_t *ci, char *buffer);
 void closeContentInput(contentitem_t *ci, contentitem_t *callerci);
 void seekContentInput(contentitem_t *ci, uint24_t position); // position relative to start of input
 
@@ -14,25 +14,35 @@
 #include "io.h"
 #include "macro.h"
 #include "assemble.h"
+#include "arena.h"
+#include "includecache.h"
 
 // Total allocated memory for labels
 uint24_t labelmemsize;
+arena_t  labelarena;
 
 // memory for anonymous labels
+anonymouslabel_t *anonymousLabelTable;  // in sequence of definition, grows when needed
+uint24_t anonymouslabelcapacity;
+uint24_t anonymouslabelcount;
+uint24_t anonymouslabelindex;           // next label to read during the next pass
 anonymouslabel_t an_prev;
 anonymouslabel_t an_next;
 label_t an_return;
 
 // tables
-label_t* globalLabelTable[GLOBAL_LABEL_TABLE_SIZE]; // hash table
-uint16_t globalLabelCounter;
+label_t** globalLabelTable;                         // hash table, power of two size, grows with the number of labels
+uint24_t globalLabelTableSize;
+uint24_t globalLabelCounter;
 
 void saveGlobalLabelTable(void) {
-    int i;
+    uint24_t i;
     char *ptr;
     label_t *lbl;
     FILE *fh;
-    char buffer[LINEMAX+1];
+    char buffer[INPUT_BUFFERSIZE];  // lines are collected here and written in blocks
+    uint24_t length = 0;
+    uint24_t namelength;
     char filename[FILENAMEMAXLENGTH + 1];
 
     strcpy(filename, filebasename);
@@ -44,32 +54,86 @@ void saveGlobalLabelTable(void) {
         return;
     }
 
-    for(i = 0; i < GLOBAL_LABEL_TABLE_SIZE; i++) {
+    for(i = 0; i < globalLabelTableSize; i++) {
         if(globalLabelTable[i]) {
             lbl = globalLabelTable[i];
             while(lbl) {
-                if(!lbl->local) sprintf(buffer, "%s $%x\r\n", lbl->name, lbl->address);
-                ptr = buffer;
-                while(*ptr) fputc(*ptr++, fh);
+                if(!lbl->local) {
+                    namelength = strlen(lbl->name);
+                    if((length + namelength + 12) > sizeof(buffer)) { // ' $', 8 digits and CR/LF
+                        fwrite(buffer, 1, length, fh);
+                        length = 0;
+                    }
+                    ptr = buffer + length;
+                    memcpy(ptr, lbl->name, namelength);
+                    ptr += namelength;
+                    *ptr++ = ' ';
+                    *ptr++ = '$';
+                    ptr = formatHex(ptr, lbl->address, 1, true);
+                    *ptr++ = '\r';
+                    *ptr++ = '\n';
+                    length = ptr - buffer;
+                }
                 lbl = lbl->next;
             }
         }
     }
+    fwrite(buffer, 1, length, fh);
     fclose(fh);
 }
 
-uint16_t getGlobalLabelCount(void) {
+uint24_t getGlobalLabelCount(void) {
     return globalLabelCounter;
 }
 
 void initGlobalLabelTable(void) {
-    labelmemsize = 0;
+    initArena(&labelarena, &labelmemsize);
     globalLabelCounter = 0;
     labelcollisions = 0;
-    memset(globalLabelTable, 0, sizeof(globalLabelTable));
+    globalLabelTableSize = GLOBAL_LABEL_TABLE_SIZE;
+    free(globalLabelTable);
+    globalLabelTable = (label_t **)allocateMemory(globalLabelTableSize * sizeof(label_t *), &labelmemsize);
+    if(globalLabelTable) memset(globalLabelTable, 0, globalLabelTableSize * sizeof(label_t *));
+    // The anonymous label table grows again from its start size, counted in labelmemsize
+    free(anonymousLabelTable);
+    anonymousLabelTable = NULL;
+    anonymouslabelcapacity = 0;
+}
+
+// Double the table size and re-link all labels, using their stored hash
+void _growGlobalLabelTable(void) {
+    label_t **table, *lbl, *next, *try;
+    uint24_t size, i, index;
+
+    size = globalLabelTableSize * 2;
+    table = (label_t **)malloc(size * sizeof(label_t *));
+    if(table == NULL) return; // continue with longer chains
+    memset(table, 0, size * sizeof(label_t *));
+
+    for(i = 0; i < globalLabelTableSize; i++) {
+        lbl = globalLabelTable[i];
+        while(lbl) {
+            next = lbl->next;
+            lbl->next = NULL;
+            index = lbl->hash & (size - 1);
+            if(table[index] == NULL) table[index] = lbl;
+            else { // keep the order of definition
+                try = table[index];
+                while(try->next) try = try->next;
+                try->next = lbl;
+            }
+            lbl = next;
+        }
+    }
+    free(globalLabelTable);
+    labelmemsize += (size - globalLabelTableSize) * sizeof(label_t *);
+    globalLabelTable = table;
+    globalLabelTableSize = size;
 }
 
 void initAnonymousLabelTable(void) {
+    if(pass == STARTPASS) anonymouslabelcount = 0;
+    anonymouslabelindex = 0;
     an_prev.defined = false;
     an_next.defined = false;
     an_return.name = NULL;
@@ -94,21 +158,79 @@ label_t * findLocalLabel(const char *key) {
     return findGlobalLabel(compoundname);
 }
 
+// Anonymous labels are kept in memory, unless the minimum memory configuration
+// opened a file for them on the Agon
+bool _anonymousLabelsOnDisk(void) {
+    return filehandle[FILE_ANONYMOUS_LABELS] != NULL;
+}
+
 void writeAnonymousLabel(uint24_t labelAddress) {
     uint8_t scope;
+    anonymouslabel_t *table;
+    uint24_t capacity;
 
     scope = contentlevel;
-    fwrite((char*)&labelAddress, sizeof(labelAddress), 1, filehandle[FILE_ANONYMOUS_LABELS]);
-    fwrite((char*)&scope, sizeof(scope), 1, filehandle[FILE_ANONYMOUS_LABELS]);
-    fflush(filehandle[FILE_ANONYMOUS_LABELS]);
+    // During the first pass, only the previous label is known
+    an_prev.address = labelAddress;
+    an_prev.scope = scope;
+    an_prev.defined = true;
+
+    if(_anonymousLabelsOnDisk()) {
+        fwrite((char*)&labelAddress, sizeof(labelAddress), 1, filehandle[FILE_ANONYMOUS_LABELS]);
+        fwrite((char*)&scope, sizeof(scope), 1, filehandle[FILE_ANONYMOUS_LABELS]);
+        fflush(filehandle[FILE_ANONYMOUS_LABELS]);
+        anonymouslabelcount++;
+        return;
+    }
+
+    if(anonymouslabelcount == anonymouslabelcapacity) {
+        capacity = anonymouslabelcapacity ? anonymouslabelcapacity * 2 : ANONYMOUS_LABEL_TABLE_START;
+        table = (anonymouslabel_t *)realloc(anonymousLabelTable, capacity * sizeof(anonymouslabel_t));
+        if(table == NULL) {
+            error(message[ERROR_MEMORY],0);
+            return;
+        }
+        labelmemsize += (capacity - anonymouslabelcapacity) * sizeof(anonymouslabel_t);
+        anonymousLabelTable = table;
+        anonymouslabelcapacity = capacity;
+    }
+    anonymousLabelTable[anonymouslabelcount].address = labelAddress;
+    anonymousLabelTable[anonymouslabelcount].scope = scope;
+    anonymousLabelTable[anonymouslabelcount].defined = true;
+    anonymouslabelcount++;
+}
+
+uint24_t getAnonymousLabelCount(void) {
+    return anonymouslabelcount;
+}
+
+// Set the previous/next anonymous labels as if 'index' anonymous labels have been passed
+void seekAnonymousLabel(uint24_t index) {
+    initAnonymousLabelTable();
+    anonymouslabelindex = index ? index - 1 : 0; // start reading at the previous label, if any
+    if(_anonymousLabelsOnDisk()) fseek(filehandle[FILE_ANONYMOUS_LABELS], anonymouslabelindex * (sizeof(uint24_t) + sizeof(uint8_t)), SEEK_SET);
+    if(index) readAnonymousLabel();
+    readAnonymousLabel();
+}
+
+bool _readNextAnonymousLabel(uint24_t *labelAddress, uint8_t *scope) {
+    if(_anonymousLabelsOnDisk()) {
+        if(fread((char*)labelAddress, sizeof(uint24_t), 1, filehandle[FILE_ANONYMOUS_LABELS]) == 0) return false;
+        fread((char*)scope, sizeof(uint8_t), 1, filehandle[FILE_ANONYMOUS_LABELS]);
+        return true;
+    }
+    if(anonymouslabelindex >= anonymouslabelcount) return false;
+    *labelAddress = anonymousLabelTable[anonymouslabelindex].address;
+    *scope = anonymousLabelTable[anonymouslabelindex].scope;
+    anonymouslabelindex++;
+    return true;
 }
 
 void readAnonymousLabel(void) {
     uint24_t labelAddress;
     uint8_t scope;
 
-    if(fread((char*)&labelAddress, sizeof(labelAddress), 1, filehandle[FILE_ANONYMOUS_LABELS])) {
-        fread((char*)&scope, sizeof(scope), 1, filehandle[FILE_ANONYMOUS_LABELS]);
+    if(_readNextAnonymousLabel(&labelAddress, &scope)) {
         if(an_next.defined) {
             an_prev.address = an_next.address;
             an_prev.scope = an_next.scope;
@@ -127,48 +249,51 @@ void readAnonymousLabel(void) {
 }
 
 bool insertLabel(const char *labelname, uint8_t len, uint24_t labelAddress, bool local){
-    uint8_t index;
+    uint24_t index;
+    uint16_t hash;
     label_t *tmp,*try;
 
+    hash = hash16(labelname);
+    index = hash & (globalLabelTableSize - 1);
+    try = globalLabelTable[index];
+
+    // Check for duplicates before allocating
+    while(try) {
+        if((try->hash == hash) && (strcmp(try->name, labelname) == 0)) {
+            error(message[ERROR_LABELDEFINED],"%s",labelname);
+            return false;
+        }
+        labelcollisions++;
+        try = try->next;
+    }
+
     // allocate space in buffer for label_t struct
-    tmp = (label_t *)allocateMemory(sizeof(label_t), &labelmemsize);
+    tmp = (label_t *)arenaAllocate(&labelarena, sizeof(label_t));
     if(tmp == NULL) return false;
 
     // allocate space in buffer for string and store it to buffer
-    tmp->name = (char*)allocateMemory(len+1, &labelmemsize);
+    tmp->name = (char*)arenaAllocate(&labelarena, len+1);
     if(tmp->name == NULL) return false;
 
     strcpy(tmp->name, labelname);
     tmp->local = local;
+    tmp->hash = hash;
     tmp->address = labelAddress;
     tmp->next = NULL;
 
-    index = hash256(labelname);
+    // First item on index, or place at end of linked list
     try = globalLabelTable[index];
-
-    // First item on index
-    if(try == NULL) {
-        globalLabelTable[index] = tmp;
-        globalLabelCounter++;
-        return true;
+    if(try == NULL) globalLabelTable[index] = tmp;
+    else {
+        while(try->next) try = try->next;
+        try->next = tmp;
     }
+    globalLabelCounter++;
+    if(includerecording) includeCacheLabelDefined(tmp);
 
-    // Collision on index, place at end of linked list if unique
-    while(true) {
-        if(strcmp(try->name, labelname) == 0) {
-            error(message[ERROR_LABELDEFINED],"%s",labelname);
-            return false;
-        }
-        labelcollisions++;
-        if(try->next) {
-            try = try->next;
-        }
-        else {
-            try->next = tmp;
-            globalLabelCounter++;
-            return true;
-        }
-    }
+    // Grow at an average chain length of 2, keeping the table small on the Agon
+    if((globalLabelCounter >= (globalLabelTableSize * 2)) && (globalLabelTableSize < GLOBAL_LABEL_TABLE_MAXSIZE)) _growGlobalLabelTable();
+    return true;
 }
 
 bool insertLocalLabel(const char *labelname, uint24_t labelAddress) {
@@ -192,16 +317,22 @@ bool insertLocalLabel(const char *labelname, uint24_t labelAddress) {
 }
 
 label_t *findGlobalLabel(const char *name){
-    uint8_t index;
+    uint16_t hash;
     label_t *try;
 
-    index = hash256(name);
-    try = globalLabelTable[index];
+    hash = hash16(name);
+    try = globalLabelTable[hash & (globalLabelTableSize - 1)];
 
     while(true)
     {
-        if(try == NULL) return NULL;
-        if(strcmp(try->name, name) == 0) return try;
+        if(try == NULL) {
+            if(includerecording) includeCacheInvalidate(); // depends on a label defined later
+            return NULL;
+        }
+        if((try->hash == hash) && (strcmp(try->name, name) == 0)) {
+            if(includerecording) includeCacheLabelUsed(try);
+            return try;
+        }
         try = try->next;
     }
 }
@@ -209,6 +340,7 @@ label_t *findGlobalLabel(const char *name){
 label_t *findLabel(const char *name) {
     if(name[0] == '@') {
         if(((tolower(name[1]) == 'f') || (tolower(name[1]) == 'n')) && name[2] == 0) {
+            if(includerecording) includeCacheInvalidate(); // anonymous labels aren't cached
             if(an_next.defined && an_next.scope == contentlevel) {
                 an_return.address = an_next.address;
                 return &an_return;
@@ -216,6 +348,7 @@ label_t *findLabel(const char *name) {
             else return NULL;
         }
         if(((tolower(name[1]) == 'b') || (tolower(name[1]) == 'p')) && name[2] == 0) {
+            if(includerecording) includeCacheInvalidate();
             if(an_prev.defined && an_prev.scope == contentlevel) {
                 an_return.address = an_prev.address;
                 return &an_return;
@@ -228,6 +361,7 @@ label_t *findLabel(const char *name) {
 }
 
 void advanceAnonymousLabel(void) {
+    if(pass == STARTPASS) return; // labels are recorded by definelabel
     if(currentline.label) {
         if(currentline.label[0] == '@') {
             if(currentline.label[1] == '@') {
@@ -240,6 +374,8 @@ void advanceAnonymousLabel(void) {
 void definelabel(uint24_t num){
     uint8_t len;
 
+    if(currentline.label) macroExpansionPure = false;
+
     if(pass == STARTPASS) {
         if(currentline.label == NULL) return;
 
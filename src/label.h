@@ -8,8 +8,11 @@ void initGlobalLabelTable(void);
 void initAnonymousLabelTable(void);
 void writeAnonymousLabel(uint24_t address);
 void readAnonymousLabel(void);
+void seekAnonymousLabel(uint24_t index);
+uint24_t getAnonymousLabelCount(void);
 label_t * findGlobalLabel(const char *name);
-uint16_t getGlobalLabelCount(void);
+bool insertLabel(const char *labelname, uint8_t len, uint24_t labelAddress, bool local);
+uint24_t getGlobalLabelCount(void);
 void saveGlobalLabelTable(void);
 void advanceAnonymousLabel(void);
 void definelabel(uint24_t num);
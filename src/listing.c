@@ -17,117 +17,269 @@ uint8_t  _listLineObjectCount;
 uint16_t  _listLineNumber;
 uint24_t _listSourceLineNumber;
 
+// Emit log, listing events are recorded during assembly and formatted in batches
+char     _listLog[LISTING_LOGSIZE];
+uint24_t _listLogSize;
+uint24_t _listLogLast;                  // offset of the last record
+bool     _listLogBytes;                 // the last record is a LISTRECORD_BYTES record
+
+// Assembler state of the record that is being formatted
+bool     _listInMacro;
+uint8_t  _listContentLevel;
+uint8_t  _listMacroLevel;
+uint24_t _listMacroLineNumber;
+
 char _listHeader[]     = "PC     Output      Line\n\r";
 char _listDataHeader[] = "       ";
 
 char buffer[(LINEMAX * 2) + 1];
 
+// Output a fully formatted piece of listing at once
+void _listWrite(const char *str, uint24_t length) {
+    if(list_enabled) ioWrite(FILE_LISTING, str, length);
+    if(consolelist_enabled) printf("%.*s", (int)length, str);
+}
+
 void listInit(void) {
-    sprintf(buffer, "%s", _listHeader);
-    if(list_enabled) ioPuts(FILE_LISTING, buffer);
-    if(consolelist_enabled) printf("%s", _listHeader);
+    _listWrite(_listHeader, strlen(_listHeader));
     _listLine[0] = 0;
+    _listLogSize = 0;
+    _listLogBytes = false;
 }
 
-void listStartLine(const char *line, unsigned int linenumber) {    
+void _listStartLine(const char *line, uint24_t linenumber, uint24_t lineaddress) {
     strcpy(_listLine, line);
     trimRight(_listLine);
-    _listAddress = address;
+    _listAddress = lineaddress;
     _listLineObjectCount = 0;
-    _listSourceLineNumber = currentExpandedMacro?_listSourceLineNumber:linenumber; // remember upstream linenumber during macro expansion
+    _listSourceLineNumber = _listInMacro?_listSourceLineNumber:linenumber; // remember upstream linenumber during macro expansion
     _listLineObjectCount = 0;
     _listLineNumber = 0;
 }
 
-void listPrintDSLines(int number, int value) {
-    while(number) {
-        uint8_t i = 0;
-        if(list_enabled) ioPuts(FILE_LISTING, _listDataHeader);
-        if(consolelist_enabled) printf("%s",_listDataHeader);
-
-        while(i < LISTING_OBJECTS_PER_LINE) {
-            if(number) {
-                sprintf(buffer, "%02X ",value);
-                if(list_enabled) ioPuts(FILE_LISTING, buffer);
-                if(consolelist_enabled) printf("%s",buffer);
-                number--;
-            }
-            i++;
+// Hex bytes with a trailing space, as they appear in the listing
+char *_listHexByte(char *dst, uint8_t value) {
+    dst = formatHex(dst, value, 2, false);
+    *dst++ = ' ';
+    return dst;
+}
+
+// Print data rows from a buffer, or rows of a single value without a buffer
+// With listelision set, only the first and last rows of a long block are printed. The block
+// can have rows printed before and after these rows, given as 'before' and 'after'
+void _listPrintRows(const uint8_t *data, uint8_t value, uint24_t count, uint8_t before, uint8_t after) {
+    uint24_t rows, row, total, skipped;
+    uint8_t i, n;
+    char *ptr;
+
+    rows = (count + LISTING_OBJECTS_PER_LINE - 1) / LISTING_OBJECTS_PER_LINE;
+    total = rows + before + after;
+    for(row = 0; row < rows; row++) {
+        if(listelision && (total > (listelision * 2)) && (row + before == listelision)) {
+            skipped = (total - (listelision * 2)) * LISTING_OBJECTS_PER_LINE;
+            _listWrite(buffer, sprintf(buffer, "%s... %u bytes\n", _listDataHeader, (unsigned int)skipped));
+            if(data) data += skipped;
+            count -= skipped;
+            row += (total - (listelision * 2)) - 1;
+            continue;
         }
-        if(list_enabled) ioPuts(FILE_LISTING, "\n");
-        if(consolelist_enabled) printf("\n");
+        ptr = buffer;
+        memcpy(ptr, _listDataHeader, sizeof(_listDataHeader) - 1);
+        ptr += sizeof(_listDataHeader) - 1;
+        n = (count < LISTING_OBJECTS_PER_LINE) ? count : LISTING_OBJECTS_PER_LINE;
+        for(i = 0; i < n; i++) {
+            ptr = _listHexByte(ptr, data?data[i]:value);
+        }
+        *ptr++ = '\n';
+        _listWrite(buffer, ptr - buffer);
+        if(data) data += n;
+        count -= n;
     }
 }
 
 void listPrintLine(void) {
     uint8_t i,spaces;
+    char *ptr = buffer;
 
     if(_listLineNumber == 0) {
-        sprintf(buffer, "%06X ",_listAddress);
-        if(list_enabled) ioPuts(FILE_LISTING, buffer);
-        if(consolelist_enabled) printf("%s",buffer);
+        ptr = formatHex(ptr, _listAddress, 6, false);
+        *ptr++ = ' ';
     }
     else {
-        if(list_enabled) ioPuts(FILE_LISTING, _listDataHeader);
-        if(consolelist_enabled) printf("%s", _listDataHeader);
+        memcpy(ptr, _listDataHeader, sizeof(_listDataHeader) - 1);
+        ptr += sizeof(_listDataHeader) - 1;
     }
     for(i = 0; i < _listLineObjectCount; i++) {
-        sprintf(buffer, "%02X ",_listObjects[i]);
-        if(list_enabled) ioPuts(FILE_LISTING, buffer);
-        if(consolelist_enabled) printf("%s",buffer);
+        ptr = _listHexByte(ptr, _listObjects[i]);
     }
     spaces = LISTING_OBJECTS_PER_LINE - _listLineObjectCount;
-    for(i = 0; i < spaces; i++) {
-        sprintf(buffer, "   ");
-        if(list_enabled) ioPuts(FILE_LISTING, buffer);
-        if(consolelist_enabled) printf("%s",buffer);
-    }
+    memset(ptr, ' ', spaces * 3);
+    ptr += spaces * 3;
     if(_listLineNumber == 0) {
-        sprintf(buffer, "%04d", currentExpandedMacro?macrolinenumber:_listSourceLineNumber);
-        for(i = 1; i < contentlevel; i++) {
-            strcat(buffer, "*");
+        ptr += sprintf(ptr, "%04d", _listInMacro?_listMacroLineNumber:_listSourceLineNumber);
+        for(i = 1; i < _listContentLevel; i++) {
+            *ptr++ = '*';
         }
         if(macroexpansions) {
-            if(currentExpandedMacro) {
+            if(_listInMacro) {
                 char tmpbuffer[6];
-                snprintf(tmpbuffer, 6, "M%d ", macrolevel);
-                strcat(buffer, tmpbuffer);
+                snprintf(tmpbuffer, 6, "M%d ", _listMacroLevel);
+                strcpy(ptr, tmpbuffer);
+                ptr += strlen(ptr);
+            }
+            else {
+                memcpy(ptr, "   ", 3);
+                ptr += 3;
             }
-            else strcat(buffer, "   ");
         }
-        else strcat(buffer, " "); // single space between line# and input line, if no macros expanded
+        else *ptr++ = ' '; // single space between line# and input line, if no macros expanded
 
         for(i = maxstackdepth - i;i > 0; i--) {
-            strcat(buffer, " ");
+            *ptr++ = ' ';
         }
-        if(list_enabled) ioPuts(FILE_LISTING, buffer);
-        if(consolelist_enabled) printf("%s",buffer);
-        sprintf(buffer, "%s", _listLine);
-        if(list_enabled) ioPuts(FILE_LISTING, buffer);
-        if(consolelist_enabled) printf("%s",buffer);
+        strcpy(ptr, _listLine);
+        ptr += strlen(ptr);
     }
-
-    if(list_enabled) ioPuts(FILE_LISTING, "\n");
-    if(consolelist_enabled) printf("\n");
+    *ptr++ = '\n';
+    _listWrite(buffer, ptr - buffer);
 
     _listLineObjectCount = 0;
     _listLineNumber++;
 }
 
-void listPrintComment(const char *src) {
-        sprintf(buffer, "                       M%d %s\n", macrolevel, src);
-        if(list_enabled) ioPuts(FILE_LISTING, buffer);
-        if(consolelist_enabled) printf("%s",buffer);
+// List a block of data from a buffer, or a run of a single value without a buffer
+void _listEmitBlock(const uint8_t *data, uint8_t value, uint24_t count) {
+    uint24_t n;
+
+    // Complete the current row first, it holds the address and source line
+    n = LISTING_OBJECTS_PER_LINE - _listLineObjectCount;
+    if(n > count) n = count;
+    if(data) memcpy(_listObjects + _listLineObjectCount, data, n);
+    else memset(_listObjects + _listLineObjectCount, value, n);
+    _listLineObjectCount += n;
+    if(data) data += n;
+    count -= n;
+    if(count == 0) return;
+    listPrintLine();
+
+    // Print all full rows in bulk, the last row stays pending like with listEmit8bit
+    n = count % LISTING_OBJECTS_PER_LINE;
+    if(n == 0) n = LISTING_OBJECTS_PER_LINE;
+    _listPrintRows(data, value, count - n, 1, 1);
+    if(data) memcpy(_listObjects, data + count - n, n);
+    else memset(_listObjects, value, n);
+    _listLineObjectCount = n;
+}
+
+// Format a single record from the emit log
+void _listRender(const listrecord_t *r, const char *data) {
+    _listInMacro = r->inmacro;
+    _listContentLevel = r->contentlevel;
+    _listMacroLevel = r->macrolevel;
+    _listMacroLineNumber = r->macrolinenumber;
+
+    switch(r->type) {
+        case LISTRECORD_LINE:
+            _listStartLine(data, r->linenumber, r->value);
+            break;
+        case LISTRECORD_ENDLINE:
+            if(_listLineNumber == 0) listPrintLine(); // unfinished first line
+            if((_listLineNumber) && (_listLineObjectCount)) listPrintLine(); // unfinished last line
+            break;
+        case LISTRECORD_BYTES:
+            _listEmitBlock((const uint8_t *)data, 0, r->value);
+            break;
+        case LISTRECORD_FILL:
+            _listEmitBlock(NULL, r->fill, r->value);
+            break;
+        case LISTRECORD_DSLINES:
+            _listPrintRows(NULL, r->fill, r->value, 0, 0);
+            break;
+        case LISTRECORD_COMMENT:
+            _listWrite(buffer, sprintf(buffer, "                       M%d %s\n", r->macrolevel, data));
+            break;
+    }
+}
+
+// Format all records in the emit log
+void listFlush(void) {
+    listrecord_t r;
+    uint24_t offset = 0;
+
+    while(offset < _listLogSize) {
+        memcpy(&r, _listLog + offset, sizeof(listrecord_t));
+        offset += sizeof(listrecord_t);
+        _listRender(&r, _listLog + offset);
+        offset += r.length;
+    }
+    _listLogSize = 0;
+    _listLogBytes = false;
+}
+
+// Record a listing event with the current assembler state. Data that doesn't fit
+// the emit log at all is formatted directly, after the records before it
+void _listRecord(listrecordtype_t type, uint24_t value, uint24_t linenumber, uint8_t fill, const void *data, uint24_t length) {
+    listrecord_t r;
+
+    r.type = type;
+    r.contentlevel = contentlevel;
+    r.macrolevel = macrolevel;
+    r.inmacro = (currentExpandedMacro != NULL);
+    r.fill = fill;
+    r.value = value;
+    r.linenumber = linenumber;
+    r.macrolinenumber = macrolinenumber;
+    r.length = length;
+
+    if((_listLogSize + sizeof(listrecord_t) + length) > LISTING_LOGSIZE) listFlush();
+    if((sizeof(listrecord_t) + length) > LISTING_LOGSIZE) {
+        _listRender(&r, data);
+        return;
+    }
+    _listLogLast = _listLogSize;
+    memcpy(_listLog + _listLogSize, &r, sizeof(listrecord_t));
+    _listLogSize += sizeof(listrecord_t);
+    if(length) memcpy(_listLog + _listLogSize, data, length);
+    _listLogSize += length;
+    _listLogBytes = (type == LISTRECORD_BYTES);
+}
+
+void listStartLine(const char *line, unsigned int linenumber) {
+    _listRecord(LISTRECORD_LINE, address, linenumber, 0, line, strlen(line) + 1);
 }
 
 void listEndLine(void) {
-    if(_listLineNumber == 0) listPrintLine(); // unfinished first line
-    if((_listLineNumber) && (_listLineObjectCount)) listPrintLine(); // unfinished last line
+    _listRecord(LISTRECORD_ENDLINE, 0, 0, 0, NULL, 0);
 }
 
-void listEmit8bit(uint8_t value) {
-    if(_listLineObjectCount == LISTING_OBJECTS_PER_LINE) {
-        listPrintLine();
+void listPrintDSLines(int number, int value) {
+    _listRecord(LISTRECORD_DSLINES, number, 0, value, NULL, 0);
+}
+
+void listPrintComment(const char *src) {
+    _listRecord(LISTRECORD_COMMENT, 0, 0, 0, src, strlen(src) + 1);
+}
+
+void listEmitBytes(const uint8_t *data, uint24_t count) {
+    listrecord_t r;
+
+    // Add to the previous bytes record if possible, instructions emit their bytes one by one
+    if(_listLogBytes && ((_listLogSize + count) <= LISTING_LOGSIZE)) {
+        memcpy(&r, _listLog + _listLogLast, sizeof(listrecord_t));
+        r.value += count;
+        r.length += count;
+        memcpy(_listLog + _listLogLast, &r, sizeof(listrecord_t));
+        memcpy(_listLog + _listLogSize, data, count);
+        _listLogSize += count;
+        return;
     }
-    _listObjects[_listLineObjectCount++] = value; 
+    _listRecord(LISTRECORD_BYTES, count, 0, 0, data, count);
+}
+
+void listEmit8bit(uint8_t value) {
+    listEmitBytes(&value, 1);
+}
+
+void listEmitFill(uint8_t value, uint24_t count) {
+    _listRecord(LISTRECORD_FILL, count, 0, value, NULL, 0);
 }
\ No newline at end of file
@@ -8,6 +8,9 @@ void listStartLine(const char *line, unsigned int linenumber);
 void listEndLine(void);
 void listPrintDSLines(int number, int value);
 void listEmit8bit(uint8_t value);
+void listEmitBytes(const uint8_t *data, uint24_t count);
+void listEmitFill(uint8_t value, uint24_t count);
 void listPrintComment(const char *src);
+void listFlush(void);
 
 #endif // LISTING_H
@@ -16,17 +16,118 @@
 #include "listing.h"
 #include "str2num.h"
 #include "io.h"
+#include "arena.h"
+#include "includecache.h"
 
 // Total allocated memory for macros
 uint24_t macromemsize;
+arena_t  macroarena;
+
+// macro hash table, separate from the generated mnemonic table
+instruction_t *macro_table[MACRO_HASHTABLESIZE];
 uint8_t macroCounter;
 
 // internal tracking number per expansion. Starts at 0 and sequentially increases each expansion to create a macro expansion scope (for labels)
 uint24_t macroExpandID;
 
+// Expansion cache. Cleared by macro expansion, label definitions and anything else
+// that makes the result of the current expansion depend on the assembler state
+bool          macroExpansionPure;
+uint24_t      macroCacheHits;
+uint24_t      macroCacheMisses;
+macrocache_t *macroCache[MACROCACHE_HASHTABLESIZE];
+
+// Output bytes of the current expansion(s), nested expansions are captured after their parent's bytes
+uint8_t *_capturebuffer;
+uint24_t _capturelength;
+uint24_t _capturesize;
+bool     _capturefailed;
+bool     _capturing;
+
+// Macro body line currently being processed, copied to a line buffer
+macro_t    *_linemacro;
+const char *_linebuffer;
+uint16_t    _lineoffset;
+uint16_t    _linelength;
+
 void initMacros(void) {
-    macromemsize = 0;
+    initArena(&macroarena, &macromemsize);
     macroCounter = 0;
+    memset(macro_table, 0, sizeof(macro_table));
+    memset(macroCache, 0, sizeof(macroCache));
+    macroCacheHits = 0;
+    macroCacheMisses = 0;
+    macroExpansionPure = false;
+    _capturelength = 0;
+    _capturing = false;
+}
+
+instruction_t * macro_lookup(const char *name) {
+    instruction_t *try;
+
+    try = macro_table[lowercaseHash256(name)];
+    while(try) {
+        if(strcasecmp(try->name, name) == 0) return try;
+        try = try->next;
+    }
+    return NULL;
+}
+
+int _compareSlots(const void *a, const void *b) {
+    return (int)((const macroslot_t *)a)->offset - (int)((const macroslot_t *)b)->offset;
+}
+
+// Locate all argument occurrences in the macro body, so an expansion only needs to splice in the substitutions.
+// Arguments match like replaceArgument does, in order of the arguments. Occurrences are
+// masked after matching, so a later argument can't match in an earlier one
+bool _locateArguments(macro_t *m) {
+    char *work, *p;
+    macroslot_t *slots;
+    size_t bodylength, argument_len;
+    uint16_t count = 0;
+
+    m->slots = NULL;
+    m->slotcount = 0;
+    if(m->argcount == 0) return true;
+
+    bodylength = strlen(m->body);
+    work = (char *)malloc(bodylength + 1);
+    slots = (macroslot_t *)malloc((bodylength + 1) * sizeof(macroslot_t));
+    if((work == NULL) || (slots == NULL)) {
+        free(work);
+        free(slots);
+        error(message[ERROR_MEMORY],0);
+        return false;
+    }
+    strcpy(work, m->body);
+
+    for(uint8_t i = 0; i < m->argcount; i++) {
+        argument_len = strlen(m->arguments[i]);
+        p = work;
+        while((p = strstr(p, m->arguments[i]))) {
+            if(isalnum(*(p + argument_len)) == 0) {
+                slots[count].offset = p - work;
+                slots[count].argument = i;
+                count++;
+                memset(p, '\x01', argument_len);
+            }
+            p += argument_len;
+        }
+    }
+    free(work);
+
+    if(count) {
+        qsort(slots, count, sizeof(macroslot_t), _compareSlots);
+        m->slots = (macroslot_t *)arenaAllocate(&macroarena, count * sizeof(macroslot_t));
+        if(m->slots == NULL) {
+            free(slots);
+            return false;
+        }
+        memcpy(m->slots, slots, count * sizeof(macroslot_t));
+        m->slotcount = count;
+    }
+    free(slots);
+    return true;
 }
 
 // store macro from temporary buffer
@@ -38,10 +139,10 @@ macro_t *storeMacro(const char *name, char *buffer, uint8_t argcount, const char
     instruction_t *try, *macroinstruction;
 
     // allocate space in buffer for macro_t struct
-    tmp = (macro_t *)allocateMemory(sizeof(macro_t), &macromemsize);
+    tmp = (macro_t *)arenaAllocate(&macroarena, sizeof(macro_t));
     if(tmp == NULL) return NULL;
 
-    macroinstruction = (instruction_t *)allocateMemory(sizeof(instruction_t), &macromemsize);
+    macroinstruction = (instruction_t *)arenaAllocate(&macroarena, sizeof(instruction_t));
     if(macroinstruction == NULL) return NULL;
 
     // Link together
@@ -49,7 +150,7 @@ macro_t *storeMacro(const char *name, char *buffer, uint8_t argcount, const char
     macroinstruction->macro = tmp;
 
     len = (unsigned int)strlen(name)+1;
-    macroinstruction->name = (char *)allocateMemory(len, &macromemsize);
+    macroinstruction->name = (char *)arenaAllocate(&macroarena, len);
     if(macroinstruction->name == NULL) return NULL;
 
     tmp->name = macroinstruction->name;
@@ -63,9 +164,9 @@ macro_t *storeMacro(const char *name, char *buffer, uint8_t argcount, const char
     tmp->substitutions = NULL;
     if(argcount == 0) tmp->arguments = NULL;
     else {
-        tmp->arguments = (char **)allocateMemory(argcount * sizeof(char *), &macromemsize); // allocate array of char*
+        tmp->arguments = (char **)arenaAllocate(&macroarena, argcount * sizeof(char *)); // allocate array of char*
         if(tmp->arguments == NULL) return NULL;
-        tmp->substitutions = (char **)allocateMemory(argcount * sizeof(char *), &macromemsize);
+        tmp->substitutions = (char **)arenaAllocate(&macroarena, argcount * sizeof(char *));
         if(tmp->substitutions == NULL) return NULL;
         if((tmp->arguments == NULL) || (tmp->substitutions == NULL)) return NULL;
 
@@ -76,8 +177,7 @@ macro_t *storeMacro(const char *name, char *buffer, uint8_t argcount, const char
                 error(message[ERROR_MACROARGLENGTH],0);
                 return NULL;
             }
-            ptr = (char*)allocateMemory(len+1, &macromemsize);
-            macromemsize += len+1;
+            ptr = (char*)arenaAllocate(&macroarena, len+1);
             if(ptr == NULL) return NULL;
 
             strcpy(ptr, argptr);
@@ -87,23 +187,28 @@ macro_t *storeMacro(const char *name, char *buffer, uint8_t argcount, const char
     }
     tmp->originfilename = currentcontentitem->name;
     tmp->originlinenumber = startlinenumber;
+    if(!_locateArguments(tmp)) return NULL;
+
+    // Mnemonics, directives and other macros can't be redefined
+    if(instruction_lookup(name)) {
+        error(message[ERROR_MACRODEFINED],"%s",name);
+        return NULL;
+    }
+
+    if(includerecording) includeCacheMacroDefined(tmp);
 
     index = lowercaseHash256(name);
-    try = instruction_table[index];
+    try = macro_table[index];
 
     // First item on index
     if(try == NULL) {
-        instruction_table[index] = macroinstruction;
+        macro_table[index] = macroinstruction;
         macroCounter++;
         return tmp;
     }
 
-    // Collision on index, place at end of linked list if unique
+    // Collision on index, place at end of linked list
     while(true) {
-        if(strcasecmp(try->name, name) == 0) {
-            error(message[ERROR_MACRODEFINED],"%s",name);
-            return NULL;
-        }
         if(try->next) {
             try = try->next;
         }
@@ -115,6 +220,17 @@ macro_t *storeMacro(const char *name, char *buffer, uint8_t argcount, const char
     }
 }
 
+// store a macro with a copy of the given body, for macros restored from the include cache
+macro_t *restoreMacro(const char *name, const char *body, uint24_t bodylength, uint8_t argcount, const char *arguments, uint16_t startlinenumber) {
+    char *buffer;
+
+    buffer = (char *)arenaAllocate(&macroarena, bodylength + 1);
+    if(buffer == NULL) return NULL;
+    memcpy(buffer, body, bodylength);
+    buffer[bodylength] = 0;
+    return storeMacro(name, buffer, argcount, arguments, startlinenumber);
+}
+
 // replace the 'argument' substring in a target string, with the 'substitution' substring
 // substitution will only happen on a full word match in the target string:
 // An argument 'word' is a concatenation of alphanumerical characters, ending in a non-alphanumerical character
@@ -163,28 +279,75 @@ void replaceArgument(char *target, const char *argument, const char *substitutio
     if(bufferdirty) strcpy(target, buffer);
 }
 
-void macroExpandArg(char *dst, const char *src, const macro_t *m) {
-    strcpy(dst, src);
-    for(uint8_t i = 0; i < m->argcount; i++) {
-        replaceArgument(dst, m->arguments[i], m->substitutions[i]);
+// Register the body line that is copied to 'line' for processing, so parts of it can be expanded using the located arguments
+void setMacroLine(macro_t *m, const char *bodyline, const char *line) {
+    _linemacro = m;
+    _linebuffer = line;
+    _lineoffset = bodyline - m->body;
+    _linelength = strlen(line);
+}
+
+// Expand the arguments in src. Returns src when there is nothing to substitute, otherwise dst
+// A part of the current macro line is expanded from the located arguments, anything else by searching for them
+char *macroExpandArg(char *dst, char *src, const macro_t *m) {
+    const macroslot_t *slot, *end;
+    uint16_t start, length, position;
+    uint16_t lo, hi, mid;
+    size_t len;
+    char *ptr;
+
+    if((m != _linemacro) || (src < _linebuffer) || (src >= _linebuffer + _linelength)) {
+        strcpy(dst, src);
+        for(uint8_t i = 0; i < m->argcount; i++) {
+            replaceArgument(dst, m->arguments[i], m->substitutions[i]);
+        }
+        return dst;
     }
+
+    start = _lineoffset + (src - _linebuffer);
+    length = strlen(src);
+
+    // first slot at or after the start of src
+    lo = 0;
+    hi = m->slotcount;
+    while(lo < hi) {
+        mid = (lo + hi) / 2;
+        if(m->slots[mid].offset < start) lo = mid + 1;
+        else hi = mid;
+    }
+    slot = m->slots + lo;
+    end = m->slots + m->slotcount;
+    if((slot == end) || (slot->offset >= start + length)) return src;
+
+    ptr = dst;
+    position = 0;
+    for(; (slot < end) && (slot->offset < start + length); slot++) {
+        if(slot->offset - start + strlen(m->arguments[slot->argument]) > length) break;
+        len = slot->offset - start - position;
+        memcpy(ptr, src + position, len);
+        ptr += len;
+        len = strlen(m->substitutions[slot->argument]);
+        memcpy(ptr, m->substitutions[slot->argument], len);
+        ptr += len;
+        position = slot->offset - start + strlen(m->arguments[slot->argument]);
+    }
+    strcpy(ptr, src + position);
+    return dst;
 }
 
-// read to temporary macro buffer
+// read the macro body in a single pass, to a temporary buffer that grows as needed
 char * readMacroBody(contentitem_t *ci) {
-    char *buffer = NULL, *bufptr;
+    char *buffer = NULL, *body = NULL, *tmp;
     bool foundend = false;
     char macroline[LINEMAX+1];
-    uint16_t linelength,macrolength;
-    uint24_t filestartpos = ci->filepos;
-    uint16_t linestoread = 0;
-    char *tmp;
+    uint16_t linelength;
+    size_t macrolength, buffersize;
 
     if(pass == ENDPASS && (listing)) listEndLine(); // print out first line of macro definition
 
-    // Parse macro body and find length first
     foundend = false;
     macrolength = 0;
+    buffersize = 0;
     while((linelength = getnextContentLine(macroline, ci))) {
         ci->currentlinenumber++;
         tmp = macroline;
@@ -198,6 +361,7 @@ char * readMacroBody(contentitem_t *ci) {
         while(*tmp && (isspace(*tmp))) tmp++;
         if(strncasecmp(tmp, "macro", 5) == 0) {
             error(message[ERROR_MACROINMACRO],0);
+            free(buffer);
             return NULL;
         }
         uint8_t skipdot = (*tmp == '.')?1:0;
@@ -207,32 +371,146 @@ char * readMacroBody(contentitem_t *ci) {
                 break;
             }
         }
-        macrolength += linelength + 1;
-        linestoread++;
+        if(pass == STARTPASS) {
+            linelength = strlen(macroline);
+            if(macrolength + linelength + 1 > buffersize) {
+                buffersize = buffersize ? buffersize * 2 : 4 * LINEMAX;
+                if(macrolength + linelength + 1 > buffersize) buffersize = macrolength + linelength + 1;
+                tmp = (char *)realloc(buffer, buffersize);
+                if(tmp == NULL) {
+                    free(buffer);
+                    error(message[ERROR_MEMORY],0);
+                    return NULL;
+                }
+                buffer = tmp;
+            }
+            memcpy(buffer + macrolength, macroline, linelength);
+            macrolength += linelength;
+        }
     }
     if(!foundend) {
         error(message[ERROR_MACROUNFINISHED],0);
+        free(buffer);
+        return NULL;
+    }
+    if(macrolength > UINT16_MAX) { // offsets into the body are 16-bit
+        error(message[ERROR_MACROMEMORYALLOCATION],0);
+        free(buffer);
         return NULL;
     }
 
     if(pass == STARTPASS) {
-        // allocate memory for macro body
-        buffer = allocateMemory(macrolength, &macromemsize);
-        if(!buffer) return false;
-        bufptr = buffer;
-
-        // rewind file input
-        seekContentInput(ci, filestartpos);
-        // Read macro lines to buffer
-        for(uint16_t n = 0; n < linestoread; n++) {
-            getnextContentLine(macroline, ci);
-            tmp = macroline;
-            while(*tmp) *bufptr++ = *tmp++;
-            *bufptr = 0;
+        // copy macro body to its final size
+        body = arenaAllocate(&macroarena, macrolength + 1);
+        if(body) {
+            if(macrolength) memcpy(body, buffer, macrolength);
+            body[macrolength] = 0;
+        }
+        free(buffer);
+    }
+    return body;
+}
+
+// Find the expansion result for the current substitutions of a macro, adding an empty one when not found
+macrocache_t *findMacroExpansion(macro_t *m) {
+    char key[(MACROMAXARGS * (MACROARGSUBSTITUTIONLENGTH + 1)) + 1];
+    char *ptr = key;
+    uint16_t hash;
+    macrocache_t *try;
+
+    for(uint8_t i = 0; i < m->argcount; i++) {
+        ptr += strcompound(ptr, m->substitutions[i], "\n");
+    }
+    *ptr = 0;
+    hash = hash16(key) ^ (uint16_t)((uintptr_t)m / sizeof(macro_t));
+
+    for(try = macroCache[hash & (MACROCACHE_HASHTABLESIZE - 1)]; try; try = try->next) {
+        if((try->macro == m) && (try->hash == hash) && (try->adlmode == adlmode) &&
+           (try->cputype == cputype) && (strcmp(try->substitutions, key) == 0)) return try;
+    }
+
+    try = (macrocache_t *)arenaAllocate(&macroarena, sizeof(macrocache_t));
+    if(try == NULL) return NULL;
+    try->substitutions = arenaString(&macroarena, key);
+    if(try->substitutions == NULL) return NULL;
+    try->macro = m;
+    try->hash = hash;
+    try->adlmode = adlmode;
+    try->cputype = cputype;
+    try->flags = 0;
+    try->size = 0;
+    try->bytes = NULL;
+    try->next = macroCache[hash & (MACROCACHE_HASHTABLESIZE - 1)];
+    macroCache[hash & (MACROCACHE_HASHTABLESIZE - 1)] = try;
+    return try;
+}
+
+// Repeat an earlier expansion without processing the macro body. Returns false if it needs to be expanded
+bool replayMacroExpansion(macrocache_t *e) {
+    if((pass == ENDPASS) || singlepass) {
+        if(!(e->flags & MACROCACHE_ENCODED)) return false;
+        for(uint24_t n = 0; n < e->size; n++) emit_8bit(e->bytes[n]);
+    }
+    else {
+        if(!(e->flags & MACROCACHE_SIZED)) return false;
+        address += e->size;
+    }
+    macroCacheHits++;
+    return true;
+}
+
+// Store the result of a completed expansion, if it didn't depend on the assembler state
+void recordMacroExpansion(macrocache_t *e, uint24_t size, uint24_t capturestart, bool pure) {
+    macroCacheMisses++;
+    if(macrolevel == 1) _capturing = false;
+    if((pass == ENDPASS) || singlepass) {
+        if(e->flags & (MACROCACHE_ENCODED | MACROCACHE_NOENCODE)) return;
+        if(!pure || _capturefailed || (_capturelength - capturestart != size)) {
+            e->flags |= MACROCACHE_NOENCODE;
+            return;
+        }
+        e->bytes = (uint8_t *)arenaAllocate(&macroarena, size);
+        if(e->bytes == NULL) return;
+        memcpy(e->bytes, _capturebuffer + capturestart, size);
+        e->size = size;
+        e->flags |= MACROCACHE_ENCODED;
+    }
+    else {
+        if(e->flags & (MACROCACHE_SIZED | MACROCACHE_NOSIZE)) return;
+        if(!pure) {
+            e->flags |= MACROCACHE_NOSIZE;
+            return;
+        }
+        e->size = size;
+        e->flags |= MACROCACHE_SIZED;
+    }
+}
+
+// Returns the capture position for a new expansion, resetting the capture for an outermost expansion
+uint24_t macroCaptureStart(void) {
+    if(macrolevel == 1) {
+        _capturelength = 0;
+        _capturefailed = false;
+        _capturing = true;
+    }
+    return _capturelength;
+}
+
+// Called for each output byte during a macro expansion
+void macroCaptureByte(uint8_t value) {
+    uint8_t *tmp;
+
+    if(!_capturing || _capturefailed) return;
+    if(_capturelength == _capturesize) {
+        tmp = (uint8_t *)realloc(_capturebuffer, _capturesize ? _capturesize * 2 : LINEMAX);
+        if(tmp == NULL) {
+            _capturefailed = true;
+            return;
         }
-        getnextContentLine(macroline, ci); // read endmacro line      
+        _capturebuffer = tmp;
+        _capturesize = _capturesize ? _capturesize * 2 : LINEMAX;
     }
-    return buffer;
+    _capturebuffer[_capturelength++] = value;
 }
 
 bool parseMacroDefinition(char *str, char **name, uint8_t *argcount, char *arglist) {
@@ -6,11 +6,22 @@
 extern uint8_t macroCounter;
 extern uint24_t macromemsize;
 extern uint24_t macroExpandID;
+extern bool     macroExpansionPure;
+extern uint24_t macroCacheHits;
+extern uint24_t macroCacheMisses;
 
 void      initMacros(void);
 char *    readMacroBody(contentitem_t *ci);
+instruction_t * macro_lookup(const char *name);
 macro_t * storeMacro(const char *name, char *buffer, uint8_t argcount, const char *arguments, uint16_t startlinenumber);
-void      macroExpandArg(char *dst, const char *src, const macro_t *m);
+macro_t * restoreMacro(const char *name, const char *body, uint24_t bodylength, uint8_t argcount, const char *arguments, uint16_t startlinenumber);
+void      setMacroLine(macro_t *m, const char *bodyline, const char *line);
+char *    macroExpandArg(char *dst, char *src, const macro_t *m);
 bool      parseMacroDefinition(char *str, char **name, uint8_t *argcount, char *arglist);
+macrocache_t * findMacroExpansion(macro_t *m);
+bool      replayMacroExpansion(macrocache_t *e);
+void      recordMacroExpansion(macrocache_t *e, uint24_t size, uint24_t capturestart, bool pure);
+uint24_t  macroCaptureStart(void);
+void      macroCaptureByte(uint8_t value);
 bool      parseMacroArguments(macro_t *macro, char *invocation, char (*substitutionlist)[MACROARGSUBSTITUTIONLENGTH + 1]);
 #endif // MACRO_H
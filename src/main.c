@@ -1,9 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <time.h>
+#ifdef UNIX
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 #include "config.h"
 #include "defines.h"
 #include "console.h"
@@ -16,9 +21,18 @@
 #include "io.h"
 #include "str2num.h"
 #include "instruction.h"
+#include "fixup.h"
+#include "expression.h"
+#include "server.h"
+#include "watch.h"
+#include "includecache.h"
 
 char inputfilename[FILENAMEMAXLENGTH + 1];
 char outputfilename[FILENAMEMAXLENGTH + 1];
+char batchfilename[FILENAMEMAXLENGTH + 1];
+unsigned int batchjobs;
+bool watchmode;
+bool serveroption;
 bool noaction;
 
 void printVersion(void) {
@@ -36,9 +50,20 @@ void printHelp(void) {
     printf("  -l\tListing to file with .lst extension\n");
     printf("  -s\tExport symbols\n");
     printf("  -d\tDirect listing to console\n");
+    printf("  -e\tList only the first and last <rows> of long data blocks\n");
     printf("  -c\tNo color codes in output\n");
     printf("  -x\tDisplay assembly statistics\n");
     printf("  -m\tMinimum memory configuration\n");
+    printf("  -f\tSingle pass assembly, forward references are patched afterwards\n");
+    printf("  -k\tInclude cache directory, definitions of unchanged include files are reused\n");
+    printf("  -p\tAssemble each input file listed in the given file, with an optional output filename (default <input>.bin)\n");
+    printf("  -j\tNumber of parallel jobs with -p, default is the number of processors\n");
+    #if defined(UNIX) && defined(__linux__)
+    printf("  -w\tWatch mode, assemble again when the input file or any file it loads changes\n");
+    #endif
+    #ifdef UNIX
+    printf("  -u\tServer socket; without other options, start a server on it. Otherwise send the command line to that server\n");
+    #endif
     printf("\n");
 }
 
@@ -52,13 +77,17 @@ void displayStatistics(void) {
         fclose(fh);
     }
     printf("\nAssembly statistics\n=============================\nLabel memory         : %6d\nLabels               : %6d\n\nMacro memory         : %6d\nMacros               : %6d\n\nInput buffers        : %6d\n-----------------------------\nTotal dynamic memory : %6d\n\nSources parsed       : %6d\nBinfiles read        : %6d\n\nOutput size          : %6d\n\n", labelmemsize, getGlobalLabelCount(), macromemsize, macroCounter, filecontentsize, labelmemsize+macromemsize+filecontentsize, sourcefilecount, binfilecount, outputsize);
+    printf("Macro cache hits     : %6d\nMacro cache misses   : %6d\n\n", macroCacheHits, macroCacheMisses);
+    printf("Expression memory    : %6d\nExpressions          : %6d\n\n", expressionmemsize, expressionCounter);
+    if(includeCacheEnabled()) printf("Include cache hits   : %6d\nInclude cache misses : %6d\n\n", includeCacheHits, includeCacheMisses);
+    if(singlepass) printf("Fixup memory         : %6d\nForward references   : %6d\n\n", fixupmemsize, fixupCounter);
 }
 
 void parseOptions(int argc, char *argv[]) {
     int opt;
     int filenamecount = 0;
 
-    while ((opt = getopt(argc, argv, "-:lidvhsxcmb:a:o:")) != -1) {
+    while ((opt = getopt(argc, argv, "-:lidvhsxcmfwb:a:o:e:p:j:k:u:")) != -1) {
         switch(opt) {
             case 'a':
                 if((strlen(optarg) != 1) || 
@@ -86,9 +115,54 @@ void parseOptions(int argc, char *argv[]) {
                 printf("Setting minimum memory configuration\n");
                 completefilebuffering = false;
                 break;
+            case 'f':
+                singlepass = true;
+                break;
+            case 'w':
+                watchmode = true;
+                break;
+            case 'u':
+                serveroption = true; // handled by main, unless it is part of a server request
+                break;
             case 'l':
                 list_enabled = true;
                 break;
+            case 'p':
+                if(strlen(optarg) > FILENAMEMAXLENGTH) {
+                    error("option -p: Filename too long",0);
+                    return;
+                }
+                strcpy(batchfilename, optarg);
+                break;
+            case 'k':
+                if(strlen(optarg) > FILENAMEMAXLENGTH) {
+                    error("option -k: Directory name too long",0);
+                    return;
+                }
+                strcpy(cachedirectory, optarg);
+                break;
+            case 'j':
+                if(strlen(optarg) > 3) {
+                    error("option -j: Invalid number of jobs",0);
+                    return;
+                }
+                batchjobs = str2num(optarg, strlen(optarg));
+                if(err_str2num || (batchjobs == 0)) {
+                    error("option -j: Invalid number of jobs",0);
+                    return;
+                }
+                break;
+            case 'e':
+                if(strlen(optarg) > 6) {
+                    error("option -e: Invalid number of rows",0);
+                    return;
+                }
+                listelision = str2num(optarg, strlen(optarg));
+                if(err_str2num) {
+                    error("option -e: Invalid number of rows",0);
+                    return;
+                }
+                break;
             case 'i':
                 ignore_truncation_warnings = true;
                 break;
@@ -135,6 +209,21 @@ void parseOptions(int argc, char *argv[]) {
                     case 'o':
                         error("option -o: Missing start address value",0);
                         break;
+                    case 'e':
+                        error("option -e: Missing number of rows",0);
+                        break;
+                    case 'p':
+                        error("option -p: Missing filename",0);
+                        break;
+                    case 'j':
+                        error("option -j: Missing number of jobs",0);
+                        break;
+                    case 'k':
+                        error("option -k: Missing directory",0);
+                        break;
+                    case 'u':
+                        error("option -u: Missing socket",0);
+                        break;
                     default:
                         error("Unknown option", "%c", optopt);
                         break;
@@ -162,6 +251,11 @@ void parseOptions(int argc, char *argv[]) {
         }
     }
 
+    if(strlen(batchfilename)) {
+        if(filenamecount) error("No input filename allowed with option -p",0);
+        if(watchmode) error("Option -w not allowed with option -p",0);
+        return;
+    }
     if((argc == 1) || (filenamecount == 0)) {
         error("No input filename",0);
         printHelp();
@@ -169,14 +263,182 @@ void parseOptions(int argc, char *argv[]) {
     }
 }
 
-int main(int argc, char *argv[]) {
+// Assemble a single file with the current options, returns the exit code
+int assembleFile(const char *input, const char *output) {
     clock_t begin, end;
 
+    errorcount = 0;
+    if(!ioInit(input, output)) return EXIT_ERROR;
+    
+    printf("Assembling %s\n", input);
+    if(list_enabled) printf("Listing to %s\n", filename[FILE_LISTING]);
+
+    initAssembler();
+    
+    // Assemble input to output
+    begin = clock();
+    assemble(input);
+    end = clock();
+
+    ioClose();
+
+    if(errorcount) return EXIT_ERROR;
+    else printf("Done in %.2f seconds\n",((double)(end - begin) / CLOCKS_PER_SEC));
+
+    if(exportsymbols) saveGlobalLabelTable();
+    if(displaystatistics) displayStatistics();
+
+    return EXIT_SUCCESS;
+}
+
+// Read all jobs from the batch file, one input filename and an optional output filename per line
+// Without an output filename, the output is named after the input file with a .bin extension
+// Empty lines and lines starting with ';' are skipped. Returns the number of jobs, jobs are freed by the caller
+// On an error, no jobs are returned
+unsigned int readBatchFile(batchjob_t **jobs) {
+    char line[LINEMAX+1];
+    char *ptr, *name;
+    unsigned int count = 0, capacity = 0;
+    batchjob_t *table;
+    FILE *fh;
+
+    *jobs = NULL;
+    fh = ioOpenfile(batchfilename, "r");
+    if(fh == NULL) return 0;
+
+    while(fgets(line, sizeof(line), fh)) {
+        ptr = line;
+        while(isspace(*ptr)) ptr++;
+        if((*ptr == 0) || (*ptr == ';')) continue;
+
+        if(count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            table = (batchjob_t *)realloc(*jobs, capacity * sizeof(batchjob_t));
+            if(table == NULL) {
+                error(message[ERROR_MEMORY],0);
+                break;
+            }
+            *jobs = table;
+        }
+        table = *jobs + count;
+        memset(table, 0, sizeof(batchjob_t));
+        for(uint8_t i = 0; i < 2; i++) {
+            name = ptr;
+            while(*ptr && !isspace(*ptr)) ptr++;
+            if(*ptr) *ptr++ = 0;
+            if(strlen(name) > FILENAMEMAXLENGTH) {
+                error("Filename too long", "%s", name);
+                break;
+            }
+            strcpy(i ? table->output : table->input, name);
+            while(isspace(*ptr)) ptr++;
+        }
+        if(errorcount) break;
+        count++;
+    }
+    fclose(fh);
+    if(errorcount) {
+        free(*jobs);
+        *jobs = NULL;
+        count = 0;
+    }
+    return count;
+}
+
+#ifdef UNIX
+// Assemble a job in a worker process. Its messages are collected and written at once
+// at the end, so they don't mix with those of other jobs
+void batchWorker(batchjob_t *job) {
+    int result, out;
+    FILE *log;
+    char *messages;
+    uint24_t size;
+
+    out = dup(STDOUT_FILENO);
+    log = tmpfile();
+    if(log && (out >= 0)) dup2(fileno(log), STDOUT_FILENO);
+    result = assembleFile(job->input, job->output);
+    fflush(stdout);
+    if(log && (out >= 0)) {
+        messages = ioReadStream(log, &size);
+        if(messages && write(out, messages, size)) {}
+    }
+    exit(result);
+}
+#endif
+
+// Assemble all jobs in the batch file, in parallel worker processes when available
+int assembleBatch(void) {
+    batchjob_t *jobs;
+    unsigned int count, failed = 0;
+    unsigned int i;
+
+    count = readBatchFile(&jobs);
+    if(errorcount) {
+        free(jobs);
+        return EXIT_ERROR;
+    }
+
+    #ifdef UNIX
+    unsigned int next = 0, running = 0;
+    int status, pid;
+
+    if(batchjobs == 0) {
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        batchjobs = (processors > 0) ? processors : 1;
+    }
+    while((next < count) || running) {
+        while((running < batchjobs) && (next < count)) {
+            fflush(stdout);
+            pid = fork();
+            if(pid == 0) batchWorker(&jobs[next]);
+            if(pid < 0) jobs[next].failed = true;
+            else running++;
+            jobs[next++].pid = pid;
+        }
+        if(running == 0) continue;
+        pid = wait(&status);
+        if(pid < 0) break;
+        running--;
+        for(i = 0; i < count; i++) {
+            if(jobs[i].pid == pid) jobs[i].failed = !WIFEXITED(status) || (WEXITSTATUS(status) != EXIT_SUCCESS);
+        }
+    }
+    #else
+    uint8_t optionfillbyte = fillbyte;
+    bool optionadlmode = adlmode;
+
+    for(i = 0; i < count; i++) {
+        fillbyte = optionfillbyte; // the previous job can change these
+        adlmode = optionadlmode;
+        jobs[i].failed = (assembleFile(jobs[i].input, jobs[i].output) != EXIT_SUCCESS);
+    }
+    #endif
+
+    for(i = 0; i < count; i++) {
+        if(jobs[i].failed) {
+            colorPrintf(RED, "Failed %s\n", jobs[i].input);
+            failed++;
+        }
+    }
+    printf("Batch done, %d of %d jobs failed\n", failed, count);
+    free(jobs);
+    return failed ? EXIT_ERROR : EXIT_SUCCESS;
+}
+
+// Assemble according to the given command line, returns the exit code
+int runCommandLine(int argc, char *argv[]) {
     // set option defaults
     noaction = false;
+    errorcount = 0;
+    optind = 0; // a server parses a new command line for each request
+    messageoutput = stdout;
+    inputfilename[0] = 0;
+    outputfilename[0] = 0;
     fillbyte = FILLBYTE;
     list_enabled = false;
     consolelist_enabled = false;
+    listelision = 0;
     adlmode = ADLMODE_START;
     start_address = START_ADDRESS;
     exportsymbols = false;
@@ -184,43 +446,60 @@ int main(int argc, char *argv[]) {
     coloroutput = true;
     completefilebuffering = true;
     ignore_truncation_warnings = false;
+    singlepass = false;
+    batchfilename[0] = 0;
+    batchjobs = 0;
+    watchmode = false;
+    serveroption = false;
+    cachedirectory[0] = 0;
 
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--watch") == 0) argv[i] = "-w";
+    }
     parseOptions(argc, argv);
 
     if(noaction) return 0;
     if(errorcount) return EXIT_ERROR;
+    #ifdef UNIX
+    // A request can't keep the server busy indefinitely, or start other processes from it
+    if(serving && (watchmode || strlen(batchfilename) || serveroption)) {
+        error("Options -w, -p and -u aren't available in a server request",0);
+        return EXIT_ERROR;
+    }
+    #endif
+    if(serveroption) { // main only takes -u <socket> as separate arguments
+        #ifdef UNIX
+        error("option -u: The socket needs to be a separate argument, as in -u <socket>",0);
+        #else
+        error("Option -u is not available on this platform",0);
+        #endif
+        return EXIT_ERROR;
+    }
 
-    if(!ioInit(inputfilename, outputfilename)) return EXIT_ERROR;
-    
-    printf("Assembling %s\n", inputfilename);
-    if(list_enabled) printf("Listing to %s\n", filename[FILE_LISTING]);
-
-    // Initializations
-    initInstructionTable();
-    initGlobalLabelTable();
-    initMacros();
-    initFileContentTable();
-    sourcefilecount = 0;
-    binfilecount = 0;
-    errorcount = 0;
-    errorreportlevel = 0;
-    maxstackdepth = 0;
-    macroexpansions = 0;
-    cputype = CPU_EZ80;
-    listing = list_enabled || consolelist_enabled;
-    
-    // Assemble input to output
-    begin = clock();
-    assemble(inputfilename);
-    end = clock();
-
-    ioClose();
-
-    if(errorcount) return EXIT_ERROR;
-    else printf("Done in %.2f seconds\n",((double)(end - begin) / CLOCKS_PER_SEC));
-
-    if(exportsymbols) saveGlobalLabelTable();
-    if(displaystatistics) displayStatistics();
+    if(strlen(batchfilename)) return assembleBatch();
+    if(watchmode) {
+        #if defined(UNIX) && defined(__linux__)
+        return watchRun(inputfilename, outputfilename);
+        #else
+        error("Option -w is not available on this platform",0);
+        return EXIT_ERROR;
+        #endif
+    }
+    return assembleFile(inputfilename, outputfilename);
+}
 
-    return EXIT_SUCCESS;
+int main(int argc, char *argv[]) {
+    #ifdef UNIX
+    // -u <socket> is handled here, the remaining arguments are for the server
+    for(int i = 1; i < argc - 1; i++) {
+        if(strcmp(argv[i], "-u") == 0) {
+            const char *socketpath = argv[i + 1];
+            messageoutput = stdout;
+            if(argc == 3) return serverRun(socketpath, runCommandLine);
+            memmove(&argv[i], &argv[i + 2], (argc - i - 2) * sizeof(char *));
+            return serverRequest(socketpath, argc - 3, argv + 1);
+        }
+    }
+    #endif
+    return runCommandLine(argc, argv);
 }
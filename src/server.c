@@ -0,0 +1,232 @@
+#ifdef UNIX
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "defines.h"
+#include "globals.h"
+#include "utils.h"
+#include "io.h"
+#include "server.h"
+
+bool serving;                            // command lines are server requests, not from the terminal
+
+// A request starts with the number of command line arguments in a single byte, followed by
+// zero-terminated strings: the working directory of the client and each of its arguments,
+// which can be empty. The client ends the request by closing its side of the connection.
+// The reply starts with the exit code in a single byte, followed by all output the command line would show
+
+bool _serverAddress(struct sockaddr_un *address, const char *socketpath) {
+    if(strlen(socketpath) >= sizeof(address->sun_path)) {
+        error("Socket path too long", "%s", socketpath);
+        return false;
+    }
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, socketpath);
+    return true;
+}
+
+// Write all bytes, the socket might accept less at a time
+bool _sendAll(int fd, const char *buffer, size_t size) {
+    ssize_t n;
+
+    while(size) {
+        n = write(fd, buffer, size);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        buffer += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Read a complete request, returns its size or 0 if it is empty or too large
+size_t _readRequest(int fd, char *buffer) {
+    size_t size = 0;
+    ssize_t n;
+
+    while(size <= SERVER_REQUESTMAX) {
+        n = read(fd, buffer + size, SERVER_REQUESTMAX + 1 - size);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return 0;
+        }
+        if(n == 0) return (size <= SERVER_REQUESTMAX) ? size : 0;
+        size += n;
+    }
+    return 0;
+}
+
+// Returns the next zero-terminated string in the request, or NULL if it runs past the end
+char *_requestString(char **ptr, const char *end) {
+    char *str = *ptr;
+    char *terminator;
+
+    terminator = memchr(str, 0, end - str);
+    if(terminator == NULL) return NULL;
+    *ptr = terminator + 1;
+    return str;
+}
+
+// Assemble a single request in this process, with its output redirected to the client
+void _serveRequest(int client, requesthandler_t handler) {
+    char request[SERVER_REQUESTMAX + 1];
+    char cwd[PATH_MAX];
+    char *argv[SERVER_MAXARGS + 1];
+    char *ptr, *end, *directory, *output;
+    int argc = 0, out;
+    uint24_t size;
+    uint8_t result, count;
+    FILE *log;
+
+    size = _readRequest(client, request);
+    if(size == 0) return;
+    end = request + size;
+    count = (uint8_t)request[0];
+    if(count >= SERVER_MAXARGS) return;
+    ptr = request + 1;
+    directory = _requestString(&ptr, end);
+    if(directory == NULL) return;
+
+    argv[argc++] = "ez80asm";
+    while(argc <= count) {
+        argv[argc] = _requestString(&ptr, end);
+        if(argv[argc] == NULL) return;
+        argc++;
+    }
+    argv[argc] = NULL;
+    if(ptr != end) return;
+    if(getcwd(cwd, sizeof(cwd)) == NULL) return;
+
+    log = tmpfile();
+    if(log == NULL) return;
+    fflush(stdout);
+    out = dup(STDOUT_FILENO);
+    dup2(fileno(log), STDOUT_FILENO);
+
+    if(chdir(directory) == 0) result = handler(argc, argv);
+    else {
+        printf("Error changing to directory %s\n", directory);
+        result = EXIT_FAILURE;
+    }
+
+    fflush(stdout);
+    dup2(out, STDOUT_FILENO);
+    close(out);
+    if(chdir(cwd)) {}
+
+    output = ioReadStream(log, &size);
+    fclose(log);
+    if(_sendAll(client, (char *)&result, 1) && output) _sendAll(client, output, size);
+    free(output);
+}
+
+// Accept assemble requests on a Unix domain socket, one at a time. File content
+// stays mapped between requests, as long as the files don't change
+int serverRun(const char *socketpath, requesthandler_t handler) {
+    struct sockaddr_un address;
+    struct stat st;
+    mode_t mask;
+    int server, client;
+
+    if(!_serverAddress(&address, socketpath)) return EXIT_FAILURE;
+    // Only a socket left behind by an earlier server is replaced, never another file
+    if(lstat(socketpath, &st) == 0) {
+        if(!S_ISSOCK(st.st_mode)) {
+            error("Not a socket, won't replace", "%s", socketpath);
+            return EXIT_FAILURE;
+        }
+        unlink(socketpath);
+    }
+    server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(server < 0) {
+        error("Error creating socket", "%s", socketpath);
+        return EXIT_FAILURE;
+    }
+    mask = umask(0177); // only the owner can connect, requests run with the permissions of the server
+    if(bind(server, (struct sockaddr *)&address, sizeof(address))) {
+        umask(mask);
+        error("Error creating socket", "%s", socketpath);
+        close(server);
+        return EXIT_FAILURE;
+    }
+    umask(mask);
+    if(listen(server, SERVER_BACKLOG)) {
+        error("Error listening on socket", "%s", socketpath);
+        close(server);
+        unlink(socketpath);
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN); // clients that disconnect early
+    keepcontent = true;
+    serving = true;
+    printf("Listening on %s\n", socketpath);
+    fflush(stdout);
+
+    while(true) {
+        client = accept(server, NULL, NULL);
+        if(client < 0) {
+            if(errno == EINTR) continue;
+            break;
+        }
+        _serveRequest(client, handler);
+        close(client);
+    }
+    close(server);
+    unlink(socketpath); // the socket this server created
+    return EXIT_FAILURE;
+}
+
+// Send the command line to a running server and show its reply, returns the exit code of the request
+int serverRequest(const char *socketpath, int argc, char *argv[]) {
+    struct sockaddr_un address;
+    char buffer[INPUT_BUFFERSIZE];
+    char cwd[PATH_MAX];
+    uint8_t result, count;
+    ssize_t n;
+    int fd;
+
+    if(argc >= SERVER_MAXARGS) {
+        error("Too many arguments for a server request",0);
+        return EXIT_FAILURE;
+    }
+    if(!_serverAddress(&address, socketpath)) return EXIT_FAILURE;
+    if(getcwd(cwd, sizeof(cwd)) == NULL) return EXIT_FAILURE;
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if((fd < 0) || connect(fd, (struct sockaddr *)&address, sizeof(address))) {
+        error("Error connecting to server", "%s", socketpath);
+        if(fd >= 0) close(fd);
+        return EXIT_FAILURE;
+    }
+
+    count = argc;
+    _sendAll(fd, (char *)&count, 1);
+    _sendAll(fd, cwd, strlen(cwd) + 1);
+    for(int i = 0; i < argc; i++) _sendAll(fd, argv[i], strlen(argv[i]) + 1);
+    shutdown(fd, SHUT_WR);
+
+    if(read(fd, &result, 1) != 1) {
+        error("No reply from server", "%s", socketpath);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    fflush(stdout);
+    while((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        if(write(STDOUT_FILENO, buffer, n)) {}
+    }
+    close(fd);
+    return result;
+}
+
+#endif // UNIX
@@ -0,0 +1,15 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "config.h"
+#include "defines.h"
+
+// Handles the command line arguments of a single request, returns the exit code
+typedef int (*requesthandler_t)(int argc, char *argv[]);
+
+extern bool serving;
+
+int serverRun(const char *socketpath, requesthandler_t handler);
+int serverRequest(const char *socketpath, int argc, char *argv[]);
+
+#endif // SERVER_H
@@ -13,6 +13,10 @@
 #include "instruction.h"
 #include "io.h"
 #include "assemble.h"
+#include "hash.h"
+#include "expression.h"
+#include "macro.h"
+#include "listing.h"
 
 // memory allocate size bytes, raise error if not available
 void *allocateMemory(size_t size, uint24_t *bytecounter) {
@@ -24,15 +28,6 @@ void *allocateMemory(size_t size, uint24_t *bytecounter) {
     return ptr;
 }
 
-// memory allocate a string, copy content and return pointer, or NULL if no memory
-char *allocateString(const char *name, uint24_t *bytecounter) {
-    char *ptr = (char *)allocateMemory(strlen(name) + 1, bytecounter);
-    if(ptr) {
-        strcpy(ptr, name);
-    }
-    return ptr;
-}
-
 // return a base filename, stripping the given extension from it
 void remove_ext (char* myStr, char extSep, char pathSep) {
     char *lastExt, *lastPath;
@@ -69,21 +64,21 @@ void displayerror(const char *msg, const char *context, errorlevel_t level) {
     if((errorcount == 1) || (level == LEVEL_WARNING)) {
         if(ci) {
             if(currentExpandedMacro) {
-                printf("Macro [%s] in \"%s\" line %d - ",currentExpandedMacro->name, currentExpandedMacro->originfilename, currentExpandedMacro->originlinenumber+macrolinenumber);
+                fprintf(messageoutput, "Macro [%s] in \"%s\" line %d - ",currentExpandedMacro->name, currentExpandedMacro->originfilename, currentExpandedMacro->originlinenumber+macrolinenumber);
             }
             else {
-                printf("File \"%s\" line %d - ", ci->name, ci->currentlinenumber);
+                fprintf(messageoutput, "File \"%s\" line %d - ", ci->name, ci->currentlinenumber);
             }
         }
-        printf("%s", msg);
+        fprintf(messageoutput, "%s", msg);
         if(strlen(context)) {
             if(level == LEVEL_WARNING)
                 vdp_set_text_colour(BRIGHT_WHITE);
             else
                 vdp_set_text_colour(YELLOW);
-            printf(" \'%s\'", context);
+            fprintf(messageoutput, " \'%s\'", context);
         }
-        printf("\n");
+        fprintf(messageoutput, "\n");
     }
     vdp_set_text_colour(BRIGHT_WHITE);
 }
@@ -101,6 +96,7 @@ void error(const char *msg, const char *contextformat, ...) {
 
     errorcount++;
     errorreportlevel = contentlevel;
+    if(consolelist_enabled) listFlush(); // keep the console listing in order with the message
 
     displayerror(msg, context, LEVEL_ERROR);
 }
@@ -109,7 +105,7 @@ void colorPrintf(int color, const char *msg, ...) {
     vdp_set_text_colour(color);
     va_list args;
     va_start(args, msg);
-    vprintf(msg, args);
+    vfprintf(messageoutput, msg, args);
     vdp_set_text_colour(BRIGHT_WHITE);
 }
 
@@ -125,6 +121,7 @@ void warning(const char *msg, const char *contextformat, ...) {
     else context[0] = 0;
 
     issue_warning = true;
+    if(consolelist_enabled) listFlush();
 
     displayerror(msg, context, LEVEL_WARNING);
 }
@@ -343,6 +340,20 @@ void validateRange24bit(int32_t value, const char *name) {
 }
 
 // Returns the value of an escaped character \c, or 255 if illegal
+// Writes a value in hexadecimal, with at least the given number of digits
+// Returns a pointer to the end of the written digits, the result isn't zero-terminated
+char *formatHex(char *dst, uint32_t value, uint8_t digits, bool lowercase) {
+    const char *hexdigits = lowercase?"0123456789abcdef":"0123456789ABCDEF";
+    uint8_t n = 1;
+
+    while((n < 8) && (value >> (n * 4))) n++;
+    if(n < digits) n = digits;
+    for(uint8_t i = n; i > 0; i--) {
+        *dst++ = hexdigits[(value >> ((i - 1) * 4)) & 0xF];
+    }
+    return dst;
+}
+
 uint8_t getEscapedChar(char c) {
     switch(c) {
         case 'a':
@@ -395,26 +406,47 @@ uint8_t getLiteralValue(const char *string) {
     return 0;
 }
 
+// Returns true if a token starts like a number, as str2num converts it
+bool numberStart(char c) {
+    return isdigit(c) || (c == '$') || (c == '#') || (c == '%');
+}
+
 // Resolves a number from a string in this order:
-// 1) Check if a label exists with this name
-// 2) If not, try converting it to a number with str2num
+// 1) A literal, or a token that starts like a number and converts to one. Labels can't
+//    be literals or have a valid number format, so these don't need a label lookup
+// 2) Check if a label exists with this name
+// 3) If not, try converting it to a number with str2num
 int32_t resolveNumber(char *str, uint8_t length, requiredResult_t requiredPass) {
     int32_t number;
-    label_t *lbl = findLabel(str);
+    label_t *lbl;
 
-    if((pass == STARTPASS) && (requiredPass == REQUIRED_LASTPASS)) return 0;
+    if((pass == STARTPASS) && (requiredPass == REQUIRED_LASTPASS) && !singlepass) return 0;
 
-    if(lbl) number = lbl->address;
-    else {
-        if(*str == '\'') number = getLiteralValue(str);
-        else {
-            number = str2num(str, length?length:strlen(str));
-            if(err_str2num) {
-                error(message[ERROR_IDENTIFIER], "%s", str);                            
-                return 0;
-            }
+    if(*str == '\'') return getLiteralValue(str);
+    if(numberStart(*str)) {
+        number = str2num(str, length?length:strlen(str));
+        if(!err_str2num) {
+            if((str[0] == '$') && (str[1] == 0)) macroExpansionPure = false; // current address
+            return number;
         }
     }
+
+    lbl = findLabel(str);
+    if(lbl) {
+        macroExpansionPure = false;
+        return lbl->address;
+    }
+
+    number = str2num(str, length?length:strlen(str));
+    if(err_str2num) {
+        if((pass == STARTPASS) && (requiredPass == REQUIRED_LASTPASS)) {
+            forwardreference = true; // resolved at the end of single pass assembly
+            macroExpansionPure = false;
+            return 0;
+        }
+        error(message[ERROR_IDENTIFIER], "%s", str);                            
+        return 0;
+    }
     return number;
 }
 
@@ -464,25 +496,49 @@ uint8_t copyLiteralToken(const char *from, char *to) {
     return len;
 }
 
+// Compiled form of the last expression evaluated by getExpressionValue,
+// NULL if it wasn't stored. A constant expression isn't stored, it is folded into the caller's terms
+expression_t *_lastExpression;
+bool _lastConstant;
+int32_t _lastValue; // value of a constant expression, not masked by a forward reference
+
 // Gets the value from an expression, possible consisting of values, labels and operators
+// The expression is compiled while it is parsed, following evaluations of the same text use the compiled terms
 int32_t getExpressionValue(char *str, requiredResult_t requiredPass) {
     uint8_t tmplength;
     streamtoken_t token;
     char buffer[LINEMAX+1];
-    char *bufptr, *errptr;
+    char names[LINEMAX+1];
+    char *bufptr, *errptr, *nameptr;
     char operator, unaryoperator;
     int32_t tmp = 0;
     int32_t total = 0;
     getValueState_t state;;
+    expressionterm_t terms[EXPRESSION_MAXTERMS];
+    expressionterm_t term;
+    expression_t *e;
+    uint8_t termcount;
+    uint16_t hash, errors;
+    bool compilable;
 
-    if((pass == STARTPASS) && (requiredPass == REQUIRED_LASTPASS)) return 0;
+    if((pass == STARTPASS) && (requiredPass == REQUIRED_LASTPASS) && !singlepass) return 0;
 
     while(isspace(*str)) str++; // eat all spaces
     errptr = str;
 
+    hash = hash16(str);
+    e = findExpression(str, hash);
+    _lastConstant = false;
+    _lastExpression = e;
+    if(e) return evaluateExpression(e, requiredPass);
+
     operator = 0; // first implicit operator
     unaryoperator = 0;
     state = START;
+    termcount = 0;
+    nameptr = names;
+    errors = errorcount;
+    compilable = true;
 
 /*  State machine
  *
@@ -548,11 +604,13 @@ int32_t getExpressionValue(char *str, requiredResult_t requiredPass) {
                 // implicit fall-through for performance
             case NUMBER:
                 bufptr = buffer;
+                memset(&term, 0, sizeof(expressionterm_t));
                 switch(*str) {
                     case '\'':
                         tmplength = copyLiteralToken(str, buffer);
                         str += tmplength;
                         tmp = resolveNumber(buffer, tmplength, requiredPass);
+                        term.type = TERM_VALUE;
                         break;
                     case '[':
                         if(getBracketToken(&token, str) == 0) {
@@ -560,12 +618,35 @@ int32_t getExpressionValue(char *str, requiredResult_t requiredPass) {
                             return 0;
                         }
                         tmp = getExpressionValue(token.start, requiredPass);
+                        *(token.next - 1) = ']'; // restore the text, it is the key to the compiled expression
                         str = token.next;
+                        if(_lastConstant) {
+                            term.type = TERM_VALUE;
+                            tmp = _lastValue;
+                        }
+                        else {
+                            term.type = TERM_EXPRESSION;
+                            term.expression = _lastExpression;
+                            if(_lastExpression == NULL) compilable = false;
+                        }
                         break;
                     default:
                         while(!strchr("+-*/<>&|^~\t ", *str)) *bufptr++ = *str++;
                         *bufptr = 0; // terminate string in buffer
                         tmp = resolveNumber(buffer, bufptr - buffer, requiredPass);
+                        if((buffer[0] == '@') || ((buffer[0] == '$') && (buffer[1] == 0))) term.type = TERM_NAME;
+                        else if(numberStart(buffer[0]) && !err_str2num) term.type = TERM_VALUE;
+                        else if((term.label = findGlobalLabel(buffer))) term.type = TERM_LABEL;
+                        else if(err_str2num) term.type = TERM_FORWARD;
+                        else term.type = TERM_VALUE; // labels can't have a valid number format
+                        if((term.type == TERM_NAME) || (term.type == TERM_FORWARD)) {
+                            if((nameptr - names) + (bufptr - buffer) + 1 > LINEMAX + 1) compilable = false;
+                            else {
+                                term.name = strcpy(nameptr, buffer);
+                                term.length = bufptr - buffer;
+                                nameptr += term.length + 1;
+                            }
+                        }
                         break;
                 }
                 
@@ -573,36 +654,49 @@ int32_t getExpressionValue(char *str, requiredResult_t requiredPass) {
                     if(unaryoperator == '-') tmp = -tmp;
                     if(unaryoperator == '~') tmp = ~tmp;
                 }
-
-                switch(operator) {
-                    case 0:
-                    case '+': total += tmp; break;
-                    case '-': total -= tmp; break;
-                    case '*': total *= tmp; break;
-                    case '<': total = total << tmp; break;
-                    case '>': total = total >> tmp; break;
-                    case '&': total = total & tmp;  break;
-                    case '|': total = total | tmp;  break;
-                    case '^': total = total ^ tmp;  break;
-                    case '~': total = total + ~tmp; break;
-                    case '/': total = total / tmp;  break;
-                    default:
-                        error(message[ERROR_OPERATOR],"%c",operator);
-                        return 0;
+                total = applyOperator(total, operator, tmp);
+
+                // add the term, values at the start of the expression are folded into a single term
+                if(term.type == TERM_VALUE) term.value = tmp;
+                else term.unaryoperator = unaryoperator;
+                term.operator = operator;
+                if((term.type == TERM_VALUE) && ((termcount == 0) || ((termcount == 1) && (terms[0].type == TERM_VALUE)))) {
+                    term.operator = 0;
+                    term.value = total;
+                    terms[0] = term;
+                    termcount = 1;
+                }
+                else {
+                    if(termcount == EXPRESSION_MAXTERMS) compilable = false;
+                    else terms[termcount++] = term;
                 }
+
                 // operation complete, reset operators 
                 operator = 0;
                 unaryoperator = 0;
 
                 while(isspace(*str)) str++; // eat all spaces
                 if(*str) state = OP;
-                else return total;
+                else {
+                    if(compilable && (errorcount == errors)) {
+                        _lastConstant = (termcount == 1) && (terms[0].type == TERM_VALUE);
+                        _lastValue = total;
+                        if(!_lastConstant) _lastExpression = storeExpression(errptr, hash, terms, termcount);
+                    }
+                    return forwardreference?0:total; // same as a first pass value until resolved
+                }
                 break;
         }
     }
     return total;
 }
 
+// Values are final during the last pass, and during single pass assembly
+// as long as no forward reference was found on the current line
+bool finalValues(void) {
+    return (pass == ENDPASS) || (singlepass && !forwardreference);
+}
+
 // efficient strcpy/strcat compound function
 uint8_t strcompound(char *dest, const char *src1, const char *src2) {
     uint8_t len = 0;
@@ -622,39 +716,40 @@ uint8_t strcompound(char *dest, const char *src1, const char *src2) {
 // Get the next line from a buffer, pointed to by *ptr
 // The stringpointer *ptr will update after each line
 uint16_t getnextMacroLine(char **ptr, char *dst) {
-    char *_nextline_ptr = *ptr;
-    uint16_t len = 0;
-
-    while(*_nextline_ptr) {
-        *dst++ = *_nextline_ptr;
-        len++;
-        if(*_nextline_ptr++ == '\n') {
-            break;
-        }
-    }
-    *dst = 0;
-    *ptr = _nextline_ptr;
+    char *end;
+    uint16_t len;
+
+    end = strchr(*ptr, '\n');
+    len = end ? (end - *ptr + 1) : strlen(*ptr);
+    memcpy(dst, *ptr, len);
+    dst[len] = 0;
+    *ptr += len;
     return len;
 }
 
+// Copy a line from the content buffer. The line end is found with memchr, the line is copied at once
 uint16_t _readFullBufferedLine(char *dst1, contentitem_t *ci) {
-    uint16_t len = 0;
+    size_t len;
     char *ptr = ci->readptr;
-
-    while(*ptr) {
-        if((len++ == LINEMAX) && (*ptr != '\n')) {
-            error(message[ERROR_LINETOOLONG],0);
-            return 0;
-        }
-        *dst1++ = *ptr;
-        if(*ptr++ == '\n') {
-            break;
-        }
+    char *end = ci->buffer + ci->size; // buffer might not be zero-terminated
+    char *stop;
+
+    // A line ends after a newline, at the end of the content, or before a zero byte
+    len = end - ptr;
+    if(len > LINEMAX + 1) len = LINEMAX + 1; // no need to look any further
+    stop = memchr(ptr, '\n', len);
+    if(stop) len = stop - ptr + 1;
+    stop = memchr(ptr, 0, len);
+    if(stop) len = stop - ptr;
+    if((len > LINEMAX) && (ptr[LINEMAX] != '\n')) {
+        error(message[ERROR_LINETOOLONG],0);
+        return 0;
     }
-    ci->readptr = ptr;
+    memcpy(dst1, ptr, len);
+    dst1[len] = 0;
+    ci->readptr = ptr + len;
     ci->filepos += len;
     ci->lastreadlength = len;
-    *dst1 = 0;
     return len;
 }
 
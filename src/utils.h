@@ -21,7 +21,6 @@ uint8_t  getDefineValueToken(streamtoken_t *token, char *src);
 uint16_t getnextContentLine(char *dst1, contentitem_t *ci);
 uint16_t getlastContentLine(char *dst1, contentitem_t *ci);
 uint16_t getnextMacroLine(char **ptr, char *dst);
-char *   allocateString(const char *name, uint24_t *bytecounter);
 void *   allocateMemory(size_t size, uint24_t *bytecounter);
 uint8_t  strcompound(char *dest, const char *src1, const char *src2);
 void     validateRange8bit(int32_t value, const char *name);
@@ -33,6 +32,10 @@ void     error(const char *msg, const char *contextformat, ...);
 void     warning(const char *msg, const char *contextformat, ...);
 void     colorPrintf(int color, const char *msg, ...);
 int32_t  getExpressionValue(char *str, requiredResult_t requiredPass);
+int32_t  resolveNumber(char *str, uint8_t length, requiredResult_t requiredPass);
+bool     numberStart(char c);
+bool     finalValues(void);
+char *   formatHex(char *dst, uint32_t value, uint8_t digits, bool lowercase);
 uint8_t  getEscapedChar(char c);
 uint8_t  getLiteralValue(const char *string);
 void     errorCPUtype(errormessage_t index);
@@ -0,0 +1,267 @@
+#if defined(UNIX) && defined(__linux__)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "config.h"
+#include "defines.h"
+#include "globals.h"
+#include "utils.h"
+#include "io.h"
+#include "label.h"
+#include "assemble.h"
+#include "watch.h"
+
+bool watching;                           // an assembly in watch mode is running
+
+// Files loaded by the previous assembly
+watchfile_t *_watchfiles;
+unsigned int _watchfilecount;
+// Files the previous assembly failed to open, watched until they are created
+char **_missingfiles;
+unsigned int _missingfilecount;
+
+// Record a file that could not be opened during the assembly
+void watchMissingFile(const char *name) {
+    char **table;
+    char *copy;
+
+    for(unsigned int i = 0; i < _missingfilecount; i++) {
+        if(strcmp(_missingfiles[i], name) == 0) return;
+    }
+    table = (char **)realloc(_missingfiles, (_missingfilecount + 1) * sizeof(char *));
+    if(table == NULL) return;
+    _missingfiles = table;
+    copy = strdup(name);
+    if(copy == NULL) return;
+    _missingfiles[_missingfilecount++] = copy;
+}
+
+void _clearMissingFiles(void) {
+    for(unsigned int i = 0; i < _missingfilecount; i++) free(_missingfiles[i]);
+    _missingfilecount = 0;
+}
+
+double _elapsedMilliseconds(const struct timespec *begin) {
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return ((end.tv_sec - begin->tv_sec) * 1000.0) + ((end.tv_nsec - begin->tv_nsec) / 1000000.0);
+}
+
+// Compare the content with the file on disk, which might have been changed or removed since it was written
+bool _fileMatches(const char *name, const char *content, uint24_t size) {
+    char buffer[INPUT_BUFFERSIZE];
+    uint24_t position = 0;
+    size_t n;
+    FILE *fh;
+    bool match;
+
+    fh = fopen(name, "rb");
+    if(fh == NULL) return false;
+    match = (ioGetfilesize(fh) == size);
+    while(match && (n = fread(buffer, 1, sizeof(buffer), fh))) {
+        match = (position + n <= size) && (memcmp(buffer, content + position, n) == 0);
+        position += n;
+    }
+    fclose(fh);
+    return match && (position == size);
+}
+
+// Write the content to the file if it differs from the file on disk, the content is freed
+bool _writeChanged(const char *name, char *content, uint24_t size) {
+    FILE *fh;
+    bool changed;
+
+    changed = !_fileMatches(name, content, size);
+    if(changed) {
+        fh = ioOpenfile(name, "wb");
+        if(fh) {
+            if(fwrite(content, 1, size, fh) != size) error("Error writing", "%s", name);
+            fclose(fh);
+        }
+    }
+    free(content);
+    return changed;
+}
+
+// Assemble into memory and update the output files that changed, returns the number of errors
+unsigned int _watchAssemble(const char *input, const char *output) {
+    char *content;
+    uint24_t size;
+    bool changed = false;
+
+    errorcount = 0;
+    memoryoutput = true;
+    watching = true;
+    _clearMissingFiles();
+    if(ioInit(input, output)) {
+        initAssembler();
+        assemble(input);
+        ioFlush();
+        if(errorcount == 0) {
+            content = ioReadStream(filehandle[FILE_OUTPUT], &size);
+            if(content) changed |= _writeChanged(filename[FILE_OUTPUT], content, size);
+            if(list_enabled) {
+                content = ioReadStream(filehandle[FILE_LISTING], &size);
+                if(content) changed |= _writeChanged(filename[FILE_LISTING], content, size);
+            }
+        }
+        ioClose();
+    }
+    memoryoutput = false;
+    watching = false;
+
+    if(errorcount) return errorcount;
+    if(exportsymbols) saveGlobalLabelTable();
+    if(changed) printf("Output written to %s\n", filename[FILE_OUTPUT]);
+    else printf("Output unchanged\n");
+    return 0;
+}
+
+// Add a file to the watch list. Its directory is watched, as editors often replace a file
+// instead of writing to it. The directory watch is shared by all files in it
+// A missing file is only watched when its directory exists
+void _watchFile(int fd, const char *name, bool missing) {
+    char directory[FILENAMEMAXLENGTH + 1];
+    watchfile_t *table;
+    const char *base;
+    int wd;
+
+    base = strrchr(name, '/');
+    if(base) {
+        if(base == name) strcpy(directory, "/");
+        else {
+            memcpy(directory, name, base - name);
+            directory[base - name] = 0;
+        }
+        base++;
+    }
+    else {
+        strcpy(directory, ".");
+        base = name;
+    }
+
+    wd = inotify_add_watch(fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+    if(wd < 0) {
+        if(!missing) error("Error watching", "%s", name);
+        return;
+    }
+    table = (watchfile_t *)realloc(_watchfiles, (_watchfilecount + 1) * sizeof(watchfile_t));
+    if(table == NULL) {
+        error(message[ERROR_MEMORY],0);
+        return;
+    }
+    _watchfiles = table;
+    _watchfiles[_watchfilecount].wd = wd;
+    strcpy(_watchfiles[_watchfilecount].name, base);
+    _watchfilecount++;
+}
+
+// Watch the input file and every file the previous assembly loaded, including includes and incbins,
+// or failed to open
+void _watchFiles(int fd, const char *input) {
+    contentitem_t *ci;
+
+    _watchfilecount = 0;
+    _watchFile(fd, input, false);
+    for(int i = 0; i < 256; i++) {
+        for(ci = filecontent[i]; ci; ci = ci->next) {
+            if(strcmp(ci->name, input)) _watchFile(fd, ci->name, false);
+        }
+    }
+    for(unsigned int i = 0; i < _missingfilecount; i++) {
+        if(strcmp(_missingfiles[i], input)) _watchFile(fd, _missingfiles[i], true);
+    }
+}
+
+// Start a new instance, watching the files of the previous assembly, returns the new descriptor
+// A new instance drops the watches of files that are no longer loaded
+int _watchInit(const char *input) {
+    int fd;
+
+    fd = inotify_init1(IN_CLOEXEC);
+    if(fd < 0) {
+        error("Error initializing file watch",0);
+        return -1;
+    }
+    errorcount = 0;
+    _watchFiles(fd, input);
+    if(errorcount) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Read the pending events, returns true if any of them concerns a watched file
+bool _readEvents(int fd) {
+    char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event;
+    bool changed = false;
+    ssize_t n;
+
+    n = read(fd, buffer, sizeof(buffer));
+    if(n <= 0) return false;
+    for(char *ptr = buffer; ptr < buffer + n; ptr += sizeof(struct inotify_event) + event->len) {
+        event = (const struct inotify_event *)ptr;
+        if(event->len == 0) continue;
+        for(unsigned int i = 0; i < _watchfilecount; i++) {
+            if((_watchfiles[i].wd == event->wd) && (strcmp(_watchfiles[i].name, event->name) == 0)) changed = true;
+        }
+    }
+    return changed;
+}
+
+// Assemble the input file again each time it, or any file it loads, changes
+// File content that didn't change stays mapped between assemblies
+// The files are watched before each assembly starts, so changes made while it runs are noticed
+int watchRun(const char *input, const char *output) {
+    struct pollfd pfd;
+    struct timespec begin;
+    uint8_t optionfillbyte = fillbyte;
+    bool optionadlmode = adlmode;
+    int fd;
+
+    keepcontent = true;
+    fd = _watchInit(input);
+    if(fd < 0) return EXIT_ERROR;
+    printf("Assembling %s\n", input);
+    _watchAssemble(input, output);
+
+    while(true) {
+        // Add the files this assembly loaded for the first time
+        errorcount = 0;
+        _watchFiles(fd, input);
+        if(errorcount) {
+            close(fd);
+            return EXIT_ERROR;
+        }
+        printf("Watching %d file%s for changes\n", _watchfilecount, (_watchfilecount == 1)?"":"s");
+        fflush(stdout);
+
+        while(!_readEvents(fd));
+        // Wait until the changes settle, an editor can write a file in several steps
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        while(poll(&pfd, 1, WATCH_SETTLETIME) > 0) _readEvents(fd);
+        close(fd);
+
+        fd = _watchInit(input);
+        if(fd < 0) return EXIT_ERROR;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        fillbyte = optionfillbyte; // the previous assembly can change these
+        adlmode = optionadlmode;
+        printf("Reassembling %s\n", input);
+        _watchAssemble(input, output);
+        printf("Reassembled in %.1f ms\n", _elapsedMilliseconds(&begin));
+    }
+    return EXIT_SUCCESS;
+}
+
+#endif // UNIX && __linux__
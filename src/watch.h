@@ -0,0 +1,12 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "config.h"
+#include "defines.h"
+
+extern bool watching;
+
+int watchRun(const char *input, const char *output);
+void watchMissingFile(const char *name);
+
+#endif // WATCH_H
@@ -0,0 +1,48 @@
+#!/bin/bash
+# Batch test - assembles the jobs in batch.txt with -p. The failing job needs to be reported,
+# with a non-zero exit code, while the other jobs produce their binaries
+# return 0 on succesfull tests (all passed)
+# return 1 on issue during test (one or more tests didn't pass correctly)
+# return 2 on error in test SETUP 
+#
+
+tests_failed=0
+
+cd tests
+rm -f *.bin
+rm -f *.output
+../$ASMBIN -p batch.txt $@ -c -b FF -j 2 > batch.asm.output
+result=$?
+
+if [ $result -eq 0 ]; then
+    echo "batch.txt exit code 0, expected a failure"
+    tests_failed=$((tests_failed+1))
+fi
+grep -q "^Failed failing.s$" batch.asm.output
+if [ $? -ne 0 ]; then
+    echo "batch.txt failing.s not reported"
+    tests_failed=$((tests_failed+1))
+fi
+grep -q "1 of 3 jobs failed" batch.asm.output
+if [ $? -ne 0 ]; then
+    echo "batch.txt job count incorrect"
+    tests_failed=$((tests_failed+1))
+fi
+for OUTPUT in first.bin:first.expect second_out.bin:second.expect; do
+    diff ${OUTPUT%:*} ${OUTPUT#*:} >/dev/null 2>&1
+    if [ $? -ne 0 ]; then
+        echo "${OUTPUT%:*} binary error"
+        tests_failed=$((tests_failed+1))
+    else
+        echo "${OUTPUT%:*} binary match"
+    fi
+done
+rm -f *.bin
+cd ..
+
+if [ $tests_failed -eq 0 ]; then
+    echo "All batch jobs reported correctly"
+    exit 0
+else
+    exit 1
+fi
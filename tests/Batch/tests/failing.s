@@ -0,0 +1,2 @@
+; Batch job that fails to assemble
+    ld q, 1
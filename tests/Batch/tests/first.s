@@ -0,0 +1,4 @@
+; Batch job with the default output filename
+    .org $40000
+    ld a, 1
+    ret
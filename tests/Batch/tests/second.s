@@ -0,0 +1,4 @@
+; Batch job with an output filename in the batch file
+    .org $40000
+    ld hl, $123456
+    ret
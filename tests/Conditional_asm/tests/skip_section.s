@@ -0,0 +1,17 @@
+; False sections are skipped without parsing, macro definitions in them are skipped as a whole
+    .assume adl=1
+DEBUG: equ 0
+    ld a, 1
+    .if DEBUG
+    this line would not assemble
+    macro debugmacro
+    .if 1
+    nop
+    .endif
+    endmacro
+    .else
+    ld b, 2
+    .endif
+    IF DEBUG
+    ENDIF
+    ld c, 3
@@ -0,0 +1,9 @@
+; '$' in a data list is the address of the item itself
+    .assume adl=1
+    .org $40000
+    db $&$ff, $&$ff, $&$ff
+    dw24 $, $
+label:
+    db label-$, 1, label-$
+    dw $&$ffff, $ff
+    dw32 $, $
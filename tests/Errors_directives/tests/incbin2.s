@@ -0,0 +1,2 @@
+; Test for incbin offset outside of the file
+    incbin "incbin2.s", 1000
@@ -0,0 +1,2 @@
+; Test for incbin length beyond the end of the file
+    incbin "incbin3.s", 10, 1000
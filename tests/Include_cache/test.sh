@@ -0,0 +1,67 @@
+#!/bin/bash
+# Include cache test - assembling with -k needs to produce the same binaries as without it,
+# replay unchanged include files and process them again when a label they use changes
+# return 0 on succesfull tests (all passed)
+# return 1 on issue during test (one or more tests didn't pass correctly)
+# return 2 on error in test SETUP 
+#
+
+tests_failed=0
+OPTIONS=${@/-m/} # the minimum memory configuration doesn't use the include cache
+
+# assemble <file> <expected hits> <expected misses>
+assemble() {
+    ../$ASMBIN $1 $OPTIONS -c -b FF -x -k cache > ${1%.*}.asm.output
+    if [ $? -ne 0 ]; then
+        echo "$1 ASM ERROR"
+        tests_failed=$((tests_failed+1))
+        return
+    fi
+    echo -n "$1 ASM OK"
+    grep -q "Include cache hits   : *$2$" ${1%.*}.asm.output && grep -q "Include cache misses : *$3$" ${1%.*}.asm.output
+    if [ $? -ne 0 ]; then
+        echo " - cache statistics error, expected $2 hits and $3 misses"
+        tests_failed=$((tests_failed+1))
+        return
+    fi
+    diff ${1%.*}.bin ${1%.*}.expect >/dev/null
+    if [ $? -ne 0 ]; then
+        echo " - binary error"
+        tests_failed=$((tests_failed+1))
+    else
+        echo " - $2 hits, binary match"
+    fi
+}
+
+cd tests
+rm -rf cache
+rm -f *.bin *.output
+mkdir cache
+
+assemble cache.s 0 1
+assemble cache.s 1 0
+# BASE changes value, the stored definitions of cache.inc don't apply
+assemble cache_changed.s 0 1
+assemble cache_changed.s 1 0
+
+# A replayed label that is already defined is reported at its line in the include file
+../$ASMBIN cache_duplicate.s $OPTIONS -c > cache_duplicate.asm.output
+../$ASMBIN cache_duplicate.s $OPTIONS -c -k cache > cache_duplicate_cached.asm.output
+diff cache_duplicate.asm.output cache_duplicate_cached.asm.output >/dev/null
+if [ $? -ne 0 ]; then
+    echo "cache_duplicate.s error report differs with the include cache"
+    tests_failed=$((tests_failed+1))
+else
+    echo "cache_duplicate.s error report match"
+fi
+
+rm -rf cache
+rm -f *.bin
+cd ..
+
+if [ $tests_failed -eq 0 ]; then
+    echo "All include cache tests passed"
+    exit 0
+else
+    exit 1
+fi
@@ -0,0 +1,5 @@
+; Includes cache.inc, which uses BASE from this file
+BASE: equ $10
+    include "cache.inc"
+    ld a, VALUE
+    twice PORT
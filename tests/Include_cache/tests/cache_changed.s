@@ -0,0 +1,5 @@
+; Same include as cache.s, with a different value for BASE
+BASE: equ $20
+    include "cache.inc"
+    ld a, VALUE
+    twice PORT
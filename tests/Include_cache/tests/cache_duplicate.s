@@ -0,0 +1,4 @@
+; Including cache.inc twice redefines its labels, replayed from the cache the second time
+BASE: equ $10
+    include "cache.inc"
+    include "cache.inc"
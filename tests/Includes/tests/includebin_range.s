@@ -0,0 +1,8 @@
+; Partial binary includes, using offset and length
+        .incbin "incbin.binary", 2
+        ld a,b
+        .incbin "incbin.binary", 1, 3
+        ld a,b
+        ds 3
+        .incbin "incbin.binary", 0, 2
+        .incbin "incbin.binary", 4, 0
@@ -0,0 +1,51 @@
+#!/bin/bash
+# Library test - assembling from memory through bin/libez80asm.a needs to produce the
+# same binary as the command line, in repeated assemblies within one process
+# return 0 on succesfull tests (all passed)
+# return 1 on issue during test (one or more tests didn't pass correctly)
+# return 2 on error in test SETUP 
+#
+
+LIBRARY=../../bin/libez80asm.a
+
+if [ ! -f $LIBRARY ]; then
+    echo "$LIBRARY missing"
+    exit 2
+fi
+
+cd tests
+rm -f library library.bin library_lib.bin
+rm -f *.output
+gcc -DUNIX -pthread -I../../../src library.c ../$LIBRARY -o library >> library.asm.output 2>&1
+if [ $? -ne 0 ]; then
+    echo "library.c BUILD ERROR"
+    exit 2
+fi
+
+# Run from the parent directory, so the sources can only come from memory
+cd ..
+tests/library tests tests/library_lib.bin
+result=$?
+cd tests
+if [ $result -ne 0 ]; then
+    echo "library.c LIBRARY ERROR"
+    rm -f library
+    exit 1
+fi
+
+../$ASMBIN library.s $@ -c -b FF >> library.asm.output
+if [ $? -eq 1 ]; then
+    echo "library.s ASM ERROR"
+    rm -f library library.bin library_lib.bin
+    exit 1
+fi
+
+cmp library.bin library_lib.bin >/dev/null
+result=$?
+rm -f library library.bin library_lib.bin
+if [ $result -ne 0 ]; then
+    echo "library.s binary mismatch between library and command line"
+    exit 1
+fi
+echo "library.s binary match"
+exit 0
@@ -0,0 +1,73 @@
+// Assembles library.s twice in one process, from memory sources named like the files on disk
+// Usage: library <directory with the sources> <output file>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ez80asm.h"
+
+static const char *names[] = {"library.s", "library.inc", "library.data"};
+
+char *readFile(const char *directory, const char *name, size_t *size) {
+    char path[256];
+    char *buffer;
+    FILE *fh;
+
+    snprintf(path, sizeof(path), "%s/%s", directory, name);
+    fh = fopen(path, "rb");
+    if(fh == NULL) return NULL;
+    fseek(fh, 0, SEEK_END);
+    *size = ftell(fh);
+    fseek(fh, 0, SEEK_SET);
+    buffer = malloc(*size);
+    if(buffer && (fread(buffer, 1, *size, fh) != *size)) {
+        free(buffer);
+        buffer = NULL;
+    }
+    fclose(fh);
+    return buffer;
+}
+
+int main(int argc, char *argv[]) {
+    char *buffers[3];
+    size_t sizes[3], size, firstsize = 0;
+    const uint8_t *output;
+    uint8_t *first = NULL;
+    asm_context_t *ctx;
+    FILE *fh;
+
+    if(argc != 3) return 2;
+    for(int i = 0; i < 3; i++) {
+        buffers[i] = readFile(argv[1], names[i], &sizes[i]);
+        if(buffers[i] == NULL) return 2;
+    }
+
+    for(int run = 0; run < 2; run++) {
+        ctx = asmCreateContext();
+        if(ctx == NULL) return 2;
+        asmSetFillbyte(ctx, 0xFF);
+        for(int i = 0; i < 3; i++) asmAddSource(ctx, names[i], buffers[i], sizes[i]);
+        if(!asmAssemble(ctx, "library.s")) {
+            printf("run %d: %u errors\n%s", run, asmErrorCount(ctx), asmMessages(ctx, NULL));
+            return 1;
+        }
+        output = asmOutput(ctx, &size);
+        if(run == 0) {
+            first = malloc(size);
+            memcpy(first, output, size);
+            firstsize = size;
+        }
+        else if((size != firstsize) || memcmp(first, output, size)) {
+            printf("run %d: output differs from the first run\n", run);
+            return 1;
+        }
+        if(run == 1) {
+            fh = fopen(argv[2], "wb");
+            if(fh == NULL) return 2;
+            fwrite(output, 1, size, fh);
+            fclose(fh);
+        }
+        asmFreeContext(ctx);
+    }
+    printf("library: 2 assemblies from memory, %u bytes\n", (unsigned int)firstsize);
+    return 0;
+}
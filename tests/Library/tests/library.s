@@ -0,0 +1,8 @@
+; Assembled through the library from memory, and by the command line from disk
+    .org $40000
+    include "library.inc"
+start:
+    ld a, VALUE
+    twice 7
+    incbin "library.data"
+    jp start
@@ -0,0 +1,26 @@
+; Repeated invocations with identical arguments, with and without state-dependent content
+    .assume adl=1
+    macro fill val, reg
+    ld reg, val
+    ld hl, val*2
+    db val, "ab", val+1
+    endmacro
+
+    macro here val
+    ld hl, $+val
+@loop:
+    djnz @loop
+    jr @loop
+    endmacro
+
+    fill 3, b
+    fill 3, b
+    fill 4, c
+    fill 3, b
+    here 1
+    here 1
+    .assume adl=0
+    fill 3, b
+    here 1
+    .assume adl=1
+    fill 3, b
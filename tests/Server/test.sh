@@ -0,0 +1,76 @@
+#!/bin/bash
+# Server test - runs a server with -u in the background and sends it requests, that contain
+# an empty argument before the options that set the fill byte
+# return 0 on succesfull tests (all passed)
+# return 1 on issue during test (one or more tests didn't pass correctly)
+# return 2 on error in test SETUP 
+#
+
+tests_failed=0
+options=$@
+
+# Send a request with the given fill byte, the output needs to contain it
+request() {
+    rm -f server.bin
+    ../$ASMBIN -u server.sock server.s -k "" $options -c -b $1 >> server.asm.output
+    if [ $? -eq 0 ] && [ "$(od -An -tx1 server.bin | tr -d ' \n')" == "3e01$1$1c9" ]; then
+        echo "server.s fill byte $1 output match"
+    else
+        echo "server.s fill byte $1 output error"
+        tests_failed=$((tests_failed+1))
+    fi
+}
+
+cd tests
+rm -f server.sock server.bin *.output
+
+../$ASMBIN -u server.sock > server.asm.output &
+serverpid=$!
+for i in $(seq 50); do
+    [ -S server.sock ] && break
+    sleep 0.1
+done
+if [ ! -S server.sock ]; then
+    echo "Server didn't start"
+    kill $serverpid
+    exit 2
+fi
+
+if [ "$(stat -c %a server.sock 2>/dev/null || stat -f %Lp server.sock)" == "600" ]; then echo "server.sock permissions match"
+else
+    echo "server.sock permissions error"
+    tests_failed=$((tests_failed+1))
+fi
+
+request 00
+request 11
+
+# Each request starts with empty label tables
+first=$(../$ASMBIN -u server.sock anonymous.s $options -c -x | grep "Label memory")
+second=$(../$ASMBIN -u server.sock anonymous.s $options -c -x | grep "Label memory")
+if [ -n "$first" ] && [ "$first" == "$second" ]; then echo "anonymous.s label memory match"
+else
+    echo "anonymous.s label memory error"
+    tests_failed=$((tests_failed+1))
+fi
+rm -f anonymous.bin
+
+# The socket can't be attached to the option
+../$ASMBIN server.s -userver.sock -c >> server.asm.output
+if [ $? -eq 1 ] && grep -q "separate argument" server.asm.output; then echo "server.s attached socket error match"
+else
+    echo "server.s attached socket error missing"
+    tests_failed=$((tests_failed+1))
+fi
+
+kill $serverpid
+wait $serverpid 2>/dev/null
+rm -f server.sock server.bin
+cd ..
+
+if [ $tests_failed -eq 0 ]; then
+    echo "All server requests assembled succesfully"
+    exit 0
+else
+    exit 1
+fi
@@ -0,0 +1,5 @@
+; Anonymous labels, the statistics of each request need to count their table
+@@: jr @b
+@@: jr @b
+@@: jr @b
+@@: jr @b
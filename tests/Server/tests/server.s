@@ -0,0 +1,4 @@
+; Assembled by a server request, the fill byte comes from the request
+    ld a, 1
+    ds 2
+    ret
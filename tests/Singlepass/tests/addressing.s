@@ -0,0 +1,21 @@
+; forward references across address changes and relocated code
+    .assume adl=1
+    jp relocated
+    ld hl, copyend - copystart
+    align 16
+copystart:
+    .relocate 0x40000
+relocated:
+    ld hl, inside
+    jp outside
+inside:
+    ds 3
+    .endrelocate
+copyend:
+outside:
+    .assume adl=0
+    ld hl, last
+    .assume adl=1
+    ld hl, last
+last:
+    nop
@@ -0,0 +1,21 @@
+; forward references in instructions and data, patched after the first pass
+    .assume adl=1
+start:
+    jp forward
+    jr nz, forward2
+    ld hl, data
+    ld a, count
+    ld bc, end-start
+    db count, 1, 2
+    dw data & 0xFFFF
+    dl end
+forward:
+    ds 4
+forward2:
+    ld a, (ix+offset)
+    ld (iy+offset), count
+data:
+    blkb 3, count
+count: equ 5
+offset: equ 2
+end:
@@ -0,0 +1,21 @@
+; local and anonymous labels resolved after the first pass
+    .assume adl=1
+global1:
+    ld hl, @local1
+    jr @f
+    ld a,b
+@local1:
+    ld hl, @n
+@@:
+    ld hl, @p
+    ld hl, @f
+    jr @b
+@@:
+    ld hl, global2
+global2:
+    ld hl, @local1
+    ld hl, @f
+@local1:
+    nop
+@@:
+    nop
@@ -0,0 +1,16 @@
+; forward references inside macro expansions, with local macro labels
+    .assume adl=1
+    macro loadlater reg, value
+    ld reg, value
+    jr @skip
+    nop
+@skip:
+    ld a, later
+    endmacro
+
+    loadlater hl, target
+    loadlater bc, target+1
+    loadlater de, 3
+target:
+    nop
+later: equ 0x42
@@ -0,0 +1,80 @@
+#!/bin/bash
+# Watch test - runs -w in the background on a copy of watch.s, then changes its include file
+# and removes its output. Then the include file is removed and created again with other content.
+# Each time, the output needs to be written again with the new content
+# return 0 on succesfull tests (all passed)
+# return 1 on issue during test (one or more tests didn't pass correctly)
+# return 2 on error in test SETUP 
+#
+
+if [ "$(uname)" != "Linux" ]; then
+    echo "Watch mode is only available on Linux"
+    exit 0
+fi
+
+tests_failed=0
+
+# Wait up to 5 seconds for the output to contain the given bytes
+waitforoutput() {
+    for i in $(seq 50); do
+        if [ -f work.bin ] && [ "$(od -An -tx1 work.bin | tr -d ' \n')" == "$1" ]; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    return 1
+}
+
+cd tests
+rm -f work.* *.output
+cp watch.s work.s
+cp watch.inc work.inc
+sed -i 's/"watch.inc"/"work.inc"/' work.s
+
+../$ASMBIN work.s $@ -c -w > watch.asm.output &
+watchpid=$!
+
+if waitforoutput 3e01c9; then echo "work.s initial output match"
+else
+    echo "work.s initial output error"
+    tests_failed=$((tests_failed+1))
+fi
+
+sed -i 's/equ 1/equ 2/' work.inc
+if waitforoutput 3e02c9; then echo "work.inc change output match"
+else
+    echo "work.inc change output error"
+    tests_failed=$((tests_failed+1))
+fi
+
+rm -f work.bin
+sleep 0.2
+touch work.s
+if waitforoutput 3e02c9; then echo "work.bin removed output match"
+else
+    echo "work.bin removed output error"
+    tests_failed=$((tests_failed+1))
+fi
+
+mv work.inc work.tmp
+sed -i 's/equ 2/equ 3/' work.tmp
+touch work.s
+sleep 0.5
+mv work.tmp work.inc
+if waitforoutput 3e03c9; then echo "work.inc created output match"
+else
+    echo "work.inc created output error"
+    tests_failed=$((tests_failed+1))
+fi
+
+kill $watchpid
+wait $watchpid 2>/dev/null
+rm -f work.*
+cd ..
+
+if [ $tests_failed -eq 0 ]; then
+    echo "All watch mode changes assembled succesfully"
+    exit 0
+else
+    exit 1
+fi
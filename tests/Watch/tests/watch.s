@@ -0,0 +1,5 @@
+; Assembled in watch mode, the test changes VALUE while it runs
+    .org $40000
+    include "watch.inc"
+    ld a, VALUE
+    ret
@@ -0,0 +1,160 @@
+// Generates src/instructionhash.h, a collision-free hash table over all
+// mnemonics and assembler directives in the instructions[] array of src/instruction.c
+//
+// Usage: mkinstructionhash src/instruction.c > src/instructionhash.h
+//
+// Hash and displace: the upper byte of lowercaseHash16() selects a bucket, each bucket
+// has a displacement that is XOR-ed with the lower byte to find a unique slot.
+// The seed for the lower byte is chosen to get the smallest number of buckets.
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include "hash.h"
+
+#define MAXNAMES      255 // slot value 0 marks an empty slot
+#define NAMELENGTH     32
+#define SLOTS         256
+
+char     names[MAXNAMES][NAMELENGTH];
+uint16_t hashes[MAXNAMES];
+int      namecount;
+int      maxlength;
+
+uint8_t  displacement[SLOTS];
+uint8_t  slots[SLOTS];
+
+bool readNames(const char *filename) {
+    char line[512], *start, *end;
+    bool inarray = false;
+    FILE *fh;
+
+    fh = fopen(filename, "r");
+    if(fh == NULL) {
+        fprintf(stderr, "Error opening %s\n", filename);
+        return false;
+    }
+    while(fgets(line, sizeof(line), fh)) {
+        if(strstr(line, "instructions[] = {")) {
+            inarray = true;
+            continue;
+        }
+        if(!inarray) continue;
+        if(strncmp(line, "};", 2) == 0) break;
+        start = strstr(line, "{\"");
+        if(start == NULL) continue;
+        start += 2;
+        end = strchr(start, '\"');
+        if((end == NULL) || (end - start >= NAMELENGTH) || (namecount == MAXNAMES)) {
+            fprintf(stderr, "Error parsing line: %s", line);
+            fclose(fh);
+            return false;
+        }
+        *end = 0;
+        strcpy(names[namecount], start);
+        if((int)strlen(start) > maxlength) maxlength = strlen(start);
+        namecount++;
+    }
+    fclose(fh);
+    return namecount > 0;
+}
+
+// Try to place all names with the given number of buckets, largest buckets first
+bool placeNames(int buckets) {
+    int order[SLOTS], size[SLOTS];
+    int b, i, j, n, d, tmp;
+    uint8_t slot;
+    bool fits;
+
+    memset(slots, 0, sizeof(slots));
+    memset(displacement, 0, sizeof(displacement));
+    memset(size, 0, sizeof(size));
+    for(i = 0; i < namecount; i++) size[(hashes[i] >> 8) & (buckets - 1)]++;
+    for(b = 0; b < buckets; b++) order[b] = b;
+    for(i = 0; i < buckets; i++) {
+        for(j = i + 1; j < buckets; j++) {
+            if(size[order[j]] > size[order[i]]) {
+                tmp = order[i]; order[i] = order[j]; order[j] = tmp;
+            }
+        }
+    }
+
+    for(n = 0; n < buckets; n++) {
+        b = order[n];
+        if(size[b] == 0) break;
+        for(d = 0; d < SLOTS; d++) {
+            fits = true;
+            for(i = 0; fits && (i < namecount); i++) {
+                if(((hashes[i] >> 8) & (buckets - 1)) != b) continue;
+                slot = (hashes[i] & 0xFF) ^ d;
+                if(slots[slot]) fits = false;
+                else slots[slot] = i + 1; // tentatively taken
+            }
+            if(fits) break;
+            for(i = 0; i < namecount; i++) { // undo this attempt
+                if(((hashes[i] >> 8) & (buckets - 1)) != b) continue;
+                slot = (hashes[i] & 0xFF) ^ d;
+                if(slots[slot] == i + 1) slots[slot] = 0;
+            }
+        }
+        if(d == SLOTS) return false;
+        displacement[b] = d;
+    }
+    return true;
+}
+
+void printTable(const char *name, const uint8_t *table, int size) {
+    int i;
+
+    printf("static const uint8_t %s[%d] = {", name, size);
+    for(i = 0; i < size; i++) {
+        if((i % 16) == 0) printf("\n    ");
+        printf("%3d%s", table[i], (i == size - 1) ? "" : ", ");
+    }
+    printf("\n};\n");
+}
+
+int main(int argc, char *argv[]) {
+    char lowercase[NAMELENGTH];
+    int i, seed, buckets, bestseed = 0, bestbuckets = SLOTS * 2;
+
+    if(argc != 2) {
+        fprintf(stderr, "Usage: %s instruction.c\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if(!readNames(argv[1])) return EXIT_FAILURE;
+
+    for(seed = 1; seed < 256; seed++) {
+        for(i = 0; i < namecount; i++) hashes[i] = lowercaseHash16(names[i], lowercase, sizeof(lowercase), seed);
+        for(buckets = 16; buckets < bestbuckets; buckets *= 2) {
+            if(placeNames(buckets)) {
+                bestseed = seed;
+                bestbuckets = buckets;
+                break;
+            }
+        }
+    }
+    if(bestseed == 0) {
+        fprintf(stderr, "No collision-free table found\n");
+        return EXIT_FAILURE;
+    }
+    seed = bestseed;
+    buckets = bestbuckets;
+    for(i = 0; i < namecount; i++) hashes[i] = lowercaseHash16(names[i], lowercase, sizeof(lowercase), seed);
+    placeNames(buckets);
+
+    printf("// Generated by tools/mkinstructionhash.c from src/instruction.c - do not edit\n");
+    printf("// %d mnemonics and directives, %d buckets\n", namecount, buckets);
+    printf("#ifndef INSTRUCTIONHASH_H\n#define INSTRUCTIONHASH_H\n\n");
+    printf("#define INSTRUCTION_HASH_COUNT     %d\n", namecount);
+    printf("#define INSTRUCTION_HASH_SEED      %d\n", seed);
+    printf("#define INSTRUCTION_HASH_BUCKETS   %d\n", buckets);
+    printf("#define INSTRUCTION_HASH_MAXLENGTH %d\n\n", maxlength);
+    printf("// Displacement per bucket, selected by the upper byte of lowercaseHash16()\n");
+    printTable("instruction_hash_displacement", displacement, buckets);
+    printf("\n// Index+1 in instructions[] per slot, 0 for an empty slot\n");
+    printTable("instruction_hash_slots", slots, SLOTS);
+    printf("\n#endif // INSTRUCTIONHASH_H\n");
+    return EXIT_SUCCESS;
+}